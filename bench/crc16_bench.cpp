@@ -0,0 +1,66 @@
+/**
+ * @file crc16_bench.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host throughput check for the table driven Modbus CRC16
+ * g++ -O2 -std=gnu++17 -I src bench/crc16_bench.cpp -o crc16_bench
+ * @version 0.1
+ * @date 2023-08-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <crc16.h>
+#include <chrono>
+#include <cstdio>
+
+/**
+ * @brief Bitwise reference, what the table replaces
+ *
+ */
+uint16_t crc16_bitwise(const uint8_t* data, size_t len)
+{
+    uint16_t crc = CRC16_INIT;
+    for(size_t x = 0; x < len; x++)
+    {
+        crc ^= data[x];
+        for(uint8_t y = 0; y < 8; y++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC16_POLY : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+template <typename F>
+void run(const char* name, F fn, const uint8_t* frame, size_t len, uint32_t loops)
+{
+    volatile uint16_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t x = 0; x < loops; x++)
+    {
+        sink = sink + fn(frame, len);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-8s len=%3zu %8.1f ns/frame %8.1f MB/s\n", name, len, ns / loops, (len * (double)loops) / (ns / 1e9) / 1e6);
+}
+
+int main()
+{
+    /** README example, CRC must come out as 05 CB */
+    const uint8_t example[6] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x03};
+    uint16_t crc = crc16(example, 6);
+    printf("example crc %02X %02X\n", crc & 0xFF, crc >> 8);
+    if(crc != crc16_bitwise(example, 6) || (crc & 0xFF) != 0x05 || (crc >> 8) != 0xCB) { return 1; }
+
+    uint8_t frame[256];
+    for(int x = 0; x < 256; x++) { frame[x] = x * 37 + 11; }
+    const size_t sizes[] = {8, 11, 25, 256};
+    for(size_t len : sizes)
+    {
+        run("table", crc16, frame, len, 2000000);
+        run("bitwise", crc16_bitwise, frame, len, 2000000);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file encoder_bench.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host size and speed check of the payload encoders
+ * Also checks a reading replayed from the outbox encodes the same as live
+ * g++ -O2 -std=gnu++17 -I lib/hal_native/src -I src bench/encoder_bench.cpp src/encoder.cpp src/reading.cpp src/outbox.cpp
+ *     lib/hal_native/src/sd_native.cpp lib/hal_native/src/arduino_native.cpp -o encoder_bench
+ * @version 0.1
+ * @date 2023-10-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <encoder.h>
+#include <decode.h>
+#include <outbox.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static const char* names[PAYLOAD_FORMATS] = {"csv", "json", "cbor"};
+
+void run(uint8_t format, const READING &reading, uint32_t loops)
+{
+    static uint8_t buf[ENC_MAX_SIZE];
+    size_t len = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t x = 0; x < loops; x++)
+    {
+        ENC_WRITER out(buf, sizeof(buf));
+        encoders[format](reading, false, out);
+        len = out.length();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-5s %-4s values=%3u %5zu B/reading %8.1f ns/reading\n", names[format], reading.type == REG_F32 ? "f32" : "u16",
+        (unsigned)reading.count, len, ns / loops);
+}
+
+/**
+ * @brief Queue a reading in a RAM only outbox and encode it on the way out
+ * 
+ * @return false if the replayed payload differs from the live one
+ */
+bool round_trip(uint8_t format, const READING &reading)
+{
+    static OUTBOX outbox;
+    static READING replay;
+    static uint8_t live[ENC_MAX_SIZE];
+    static uint8_t queued[ENC_MAX_SIZE];
+    ENC_WRITER live_out(live, sizeof(live));
+    encoders[format](reading, true, live_out);
+
+    outbox.outbox_setup(false);
+    memset(&replay, 0, sizeof(replay));
+    if(!outbox.push(reading) || !outbox.peek(replay)) { return false; }
+    outbox.pop();
+    ENC_WRITER queued_out(queued, sizeof(queued));
+    encoders[format](replay, true, queued_out);
+
+    bool same = live_out.length() == queued_out.length() && memcmp(live, queued, live_out.length()) == 0;
+    printf("%-5s %-4s values=%3u outbox round trip %s\n", names[format], reading.type == REG_F32 ? "f32" : "u16",
+        (unsigned)reading.count, same ? "ok" : "FAILED");
+    return same;
+}
+
+int main()
+{
+    bool ok = true;
+    static READING reading;
+    reading.seq = 123456;
+    reading.epoch = 1696200000;
+    reading.addr = 1;
+    reading.msg = 0;
+    const uint16_t counts[] = {3, 10, 125};
+    for(uint16_t count : counts)
+    {
+        /** Typical u16 sensor registers scaled by 0.1 */
+        reading.type = REG_U16;
+        reading.scale = 0.1f;
+        reading.offset = 0;
+        reading.count = count;
+        for(uint16_t x = 0; x < count; x++)
+        {
+            reading.raw[x] = 200 + (x * 37) % 600;
+            reading.values[x] = reading.raw[x] * reading.scale;
+        }
+        for(uint8_t format = 0; format < PAYLOAD_FORMATS; format++)
+        {
+            run(format, reading, 200000);
+            ok &= round_trip(format, reading);
+        }
+    }
+
+    /** Word swapped floats with an offset, raw holds the IEEE bits */
+    reading.type = REG_F32;
+    reading.scale = 1;
+    reading.offset = -40;
+    reading.count = 4;
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        float value = 21.5f + x;
+        memcpy(&reading.raw[x], &value, sizeof(value));
+        reading.values[x] = value + reading.offset;
+    }
+    for(uint8_t format = 0; format < PAYLOAD_FORMATS; format++) { ok &= round_trip(format, reading); }
+    return ok ? 0 : 1;
+}
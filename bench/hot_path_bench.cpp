@@ -0,0 +1,240 @@
+/**
+ * @file hot_path_bench.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Per reading cost of the real read, format, log and config paths
+ * Links the firmware sources with lib/hal_native, prints one CSV line per case
+ * libstdc++ is linked static so operator new goes through the wrapped malloc
+ * g++ -O2 -std=gnu++17 -pthread -static-libstdc++ -DALLOC_COUNT -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ *     -I lib/hal_native/src -I src bench/hot_path_bench.cpp followed by every .cpp in src
+ *     and every .cpp in lib/hal_native/src but native_main.cpp, -o hot_path_bench
+ * ./hot_path_bench > new.csv, ./hot_path_bench --baseline old.csv to compare
+ * @version 0.1
+ * @date 2023-10-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <Arduino.h>
+#include <alloc_count.h>
+#include <coalesce.h>
+#include <crc16.h>
+#include <encoder.h>
+#include <logger.h>
+#include <reading.h>
+#include <ring_buffer.h>
+#include <rs485_msg.h>
+#include <spsc_ring.h>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/** Firmware state the read path works on, all from main.cpp */
+extern RING_BUFFER<1024> reply_ring;
+extern uint32_t frame_start;
+extern uint32_t frame_end;
+extern uint8_t tx_frame[];
+extern int16_t tx_txn;
+extern MSG_QUE send_que;
+extern std::vector<RS485_TXN> rs485_txns;
+extern SPSC_RING<READING, 16> reading_ring;
+extern LOGGER logger_lib;
+extern bool use_sd;
+void rs485_plan(bool renumbered = true);
+bool rs485_read(bool mqtt_send);
+size_t get_timestamp(char* buf, size_t size);
+void parse_config(String data);
+
+/** Register counts of the representative frames */
+static const uint16_t sizes[] = {1, 3, 10, 125};
+#define SIZE_NUM (sizeof(sizes) / sizeof(sizes[0]))
+
+/** Results go here, the firmware logs to stdout */
+static FILE* results;
+/** Shortest time each case runs, s */
+static double min_time = 0.2;
+static const char* filter = nullptr;
+/** ns/op of an earlier run by case */
+static std::map<std::string, double> baseline;
+
+/**
+ * @brief Time fn until min_time has passed, report per call cost
+ *
+ */
+template <typename F>
+void bench(const char* name, uint16_t regs, F fn)
+{
+    if(filter != nullptr && strstr(name, filter) == nullptr) { return; }
+    /** Warm caches and lazy state */
+    fn();
+
+    uint64_t iters = 0;
+    uint32_t allocs = alloc_count();
+    uint32_t bytes = alloc_bytes();
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    for(uint64_t batch = 1; elapsed < min_time; batch *= 2)
+    {
+        for(uint64_t x = 0; x < batch; x++) { fn(); }
+        iters += batch;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    allocs = alloc_count() - allocs;
+    bytes = alloc_bytes() - bytes;
+
+    double ns = elapsed * 1e9 / iters;
+    fprintf(results, "%s,%u,%llu,%.1f,%.2f,%.1f\n", name, regs, (unsigned long long)iters, ns, (double)allocs / iters, (double)bytes / iters);
+    fflush(results);
+
+    std::string key = std::string(name) + "," + std::to_string(regs);
+    auto old = baseline.find(key);
+    if(old != baseline.end())
+    {
+        fprintf(stderr, "%-22s %4u %10.1f ns/op %+7.1f%%\n", name, regs, ns, (ns / old->second - 1) * 100);
+    }
+}
+
+/**
+ * @brief Read holding register reply of regs registers from slave addr
+ *
+ */
+static std::vector<uint8_t> reply_frame(uint8_t addr, uint16_t regs)
+{
+    std::vector<uint8_t> frame = {addr, 0x03, (uint8_t)(regs * 2)};
+    for(uint16_t x = 0; x < regs; x++)
+    {
+        uint16_t value = 200 + x * 7;
+        frame.push_back(value >> 8);
+        frame.push_back(value & 0xFF);
+    }
+    uint16_t crc = crc16(frame.data(), frame.size());
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+    return frame;
+}
+
+/**
+ * @brief Earlier output of this bench, bench,regs,iters,ns_per_op,...
+ *
+ */
+static void load_baseline(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(file == nullptr) { perror(path); exit(1); }
+    char line[256];
+    while(fgets(line, sizeof(line), file) != nullptr)
+    {
+        char name[64];
+        unsigned regs;
+        unsigned long long iters;
+        double ns;
+        if(sscanf(line, "%63[^,],%u,%llu,%lf", name, &regs, &iters, &ns) == 4)
+        {
+            baseline[std::string(name) + "," + std::to_string(regs)] = ns;
+        }
+    }
+    fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    for(int x = 1; x + 1 < argc; x += 2)
+    {
+        if(strcmp(argv[x], "--baseline") == 0) { load_baseline(argv[x + 1]); }
+        else if(strcmp(argv[x], "--time") == 0) { min_time = atof(argv[x + 1]); }
+        else if(strcmp(argv[x], "--filter") == 0) { filter = argv[x + 1]; }
+    }
+
+    /** Firmware console goes to /dev/null, results keep the real stdout */
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if(freopen("/dev/null", "w", stdout) == nullptr) { return 1; }
+    char run_dir[] = "/tmp/hot_path_XXXXXX";
+    if(mkdtemp(run_dir) == nullptr) { return 1; }
+    setenv("RS485_NATIVE_DIR", run_dir, 1);
+    fprintf(results, "bench,regs,iters,ns_per_op,allocs_per_op,bytes_per_op\n");
+
+    /** One polled message per size, each on its own slave so none are merged */
+    alloc_track();
+    for(size_t x = 0; x < SIZE_NUM; x++)
+    {
+        uint8_t frame[8] = {(uint8_t)(x + 1), 0x03, 0, 0, 0, (uint8_t)sizes[x]};
+        uint16_t crc = crc16(frame, 6);
+        frame[6] = crc & 0xFF;
+        frame[7] = crc >> 8;
+        send_que.add(frame, sizeof(frame), 0, 0);
+    }
+    rs485_plan();
+
+    READING sample[SIZE_NUM];
+    for(size_t x = 0; x < SIZE_NUM; x++)
+    {
+        std::vector<uint8_t> reply = reply_frame(x + 1, sizes[x]);
+        int16_t txn = -1;
+        for(size_t y = 0; y < rs485_txns.size(); y++)
+        {
+            if(rs485_txns[y].slave == x + 1) { txn = y; }
+        }
+        const uint8_t* request = send_que.frame(x);
+
+        /** UART drain, CRC check, decode and hand off, as loop() runs it */
+        auto read_one = [&]
+        {
+            memcpy(tx_frame, request, 8);
+            tx_txn = txn;
+            reply_ring.clear();
+            frame_start = reply_ring.write_pos();
+            for(uint8_t byte : reply) { reply_ring.push(byte); }
+            frame_end = reply_ring.write_pos();
+            rs485_read(true);
+            reply_ring.release(frame_end);
+            while(reading_ring.pop(sample[x])) { }
+        };
+        bench("rs485_read", sizes[x], read_one);
+    }
+
+    /** Formatting each sink does per reading */
+    static char text[READING_TEXT_SIZE + 32];
+    static uint8_t payload[ENC_MAX_SIZE];
+    static const char* enc_names[PAYLOAD_FORMATS] = {"encode_csv", "encode_json", "encode_cbor"};
+    for(size_t x = 0; x < SIZE_NUM; x++)
+    {
+        bench("reading_format", sizes[x], [&] { reading_format(sample[x], ",", false, text, sizeof(text)); });
+        for(uint8_t format = 0; format < PAYLOAD_FORMATS; format++)
+        {
+            bench(enc_names[format], sizes[x], [&]
+            {
+                ENC_WRITER out(payload, sizeof(payload));
+                encoders[format](sample[x], true, out);
+            });
+        }
+    }
+
+    bench("get_timestamp", 0, [&] { get_timestamp(text, 32); });
+
+    /** SD log, records buffered and written a block at a time */
+    use_sd = true;
+    logger_lib.logger_setup();
+    for(size_t x = 0; x < SIZE_NUM; x++)
+    {
+        sd_format = LOG_TEXT;
+        bench("write_sd_text", sizes[x], [&] { logger_lib.write_sd(sample[x]); });
+        sd_format = LOG_BINARY;
+        bench("write_sd_bin", sizes[x], [&] { logger_lib.write_sd(sample[x]); });
+    }
+
+    /**
+     * Downlinks as applied, settings that stay put between runs
+     * Each saves to NVS, 15 and 9 rewrite every message with flash_msgs(),
+     * which is most of their time, so these are not parser cost
+     * 
+     */
+    bench("config_13_saved", 0, [&] { parse_config(String("13+off")); });
+    bench("config_15_saved", 0, [&] { parse_config(String("15+1+5+2+3600")); });
+    bench("config_9_saved", 0, [&] { parse_config(String("9+1+u16+ab+0.1+0")); });
+
+    std::string rm = std::string("rm -rf ") + run_dir;
+    return system(rm.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file outbox_check.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host check of the outbox, RAM overflow into the SD spool and replay order
+ * Runs against lib/hal_native's SD in a scratch directory
+ * g++ -O2 -std=gnu++17 -I lib/hal_native/src -I src bench/outbox_check.cpp src/outbox.cpp
+ *     lib/hal_native/src/sd_native.cpp lib/hal_native/src/arduino_native.cpp -o outbox_check
+ * @version 0.1
+ * @date 2023-09-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <outbox.h>
+#include <hal_native.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+static uint32_t failures;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if(!ok) { failures++; }
+}
+
+/**
+ * @brief Reading seq with a value pattern that ties the values to it
+ *
+ */
+static void make(READING &reading, uint32_t seq)
+{
+    reading.seq = seq;
+    reading.epoch = 1696200000 + seq;
+    reading.addr = 1 + seq % 4;
+    reading.msg = seq % 3;
+    reading.type = 0;
+    reading.scale = 0.1f;
+    reading.offset = 0;
+    reading.count = 10;
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        reading.raw[x] = seq * 16 + x;
+        reading.values[x] = reading.raw[x] * reading.scale;
+    }
+}
+
+/**
+ * @brief Replay everything, each reading must be the next seq and intact
+ *
+ * @return uint32_t Readings replayed
+ */
+static uint32_t drain(OUTBOX &outbox, uint32_t &next, bool &in_order)
+{
+    static READING reading;
+    uint32_t count = 0;
+    while(outbox.peek(reading))
+    {
+        bool intact = reading.count == 10 && reading.raw[9] == (int32_t)(reading.seq * 16 + 9) && reading.scale == 0.1f;
+        if(reading.seq != next || !intact) { in_order = false; }
+        next = reading.seq + 1;
+        outbox.pop();
+        count++;
+    }
+    return count;
+}
+
+int main()
+{
+    char run_dir[] = "/tmp/outbox_check_XXXXXX";
+    if(mkdtemp(run_dir) == nullptr) { return 1; }
+    setenv("RS485_NATIVE_DIR", run_dir, 1);
+    if(freopen("/dev/null", "w", stderr) == nullptr) { return 1; }
+    SD.begin();
+    static READING reading;
+
+    /** RAM only, the oldest readings make way */
+    {
+        static OUTBOX outbox;
+        outbox.outbox_setup(false);
+        for(uint32_t seq = 1; seq <= 1000; seq++) { make(reading, seq); outbox.push(reading); }
+        uint32_t kept = outbox.depth();
+        check(outbox.stats().dropped == 1000 - kept && outbox.spool_depth() == 0, "RAM only drops the oldest");
+        uint32_t next = 1000 - kept + 1;
+        bool in_order = true;
+        check(drain(outbox, next, in_order) == kept && in_order, "RAM only replays the newest in order");
+    }
+
+    /** RAM fills over and over into the spool, newer readings stay in RAM */
+    {
+        static OUTBOX outbox;
+        outbox.outbox_setup(true);
+        for(uint32_t seq = 1; seq <= 1000; seq++) { make(reading, seq); outbox.push(reading); }
+        check(outbox.depth() == 1000 && outbox.spool_depth() > 0 && outbox.stats().dropped == 0, "Overflow moves to the spool");
+
+        /** Send some, then queue more behind what is left */
+        uint32_t next = 1;
+        bool in_order = true;
+        for(uint32_t x = 0; x < 300 && outbox.peek(reading); x++)
+        {
+            if(reading.seq != next++) { in_order = false; }
+            outbox.pop();
+        }
+        for(uint32_t seq = 1001; seq <= 2000; seq++) { make(reading, seq); outbox.push(reading); }
+        check(drain(outbox, next, in_order) == 1700 && in_order && next == 2001, "Replay is oldest first across spool and RAM");
+        check(!SD.exists(OUTBOX_SPOOL), "Spool is removed once empty");
+    }
+
+    /** A spool left by the last boot picks up where it was */
+    {
+        static OUTBOX first;
+        first.outbox_setup(true);
+        for(uint32_t seq = 1; seq <= 500; seq++) { make(reading, seq); first.push(reading); }
+        uint32_t spooled = first.spool_depth();
+        for(uint32_t x = 0; x < 40 && first.peek(reading); x++) { first.pop(); }
+
+        static OUTBOX second;
+        second.outbox_setup(true);
+        /** Read offset is saved each time OUTBOX_SPOOL_SYNC divides what is left, a few come again */
+        uint32_t resent = (OUTBOX_SPOOL_SYNC - (spooled - 40) % OUTBOX_SPOOL_SYNC) % OUTBOX_SPOOL_SYNC;
+        check(second.spool_depth() == spooled - 40 + resent, "Restart resumes the spool");
+        uint32_t next = 40 - resent + 1;
+        bool in_order = true;
+        check(drain(second, next, in_order) == spooled - 40 + resent && in_order, "Restart replays in order");
+    }
+
+    /** A spool cut short, replay steps over it and carries on with RAM */
+    {
+        static OUTBOX outbox;
+        outbox.outbox_setup(true);
+        for(uint32_t seq = 1; seq <= 1000; seq++) { make(reading, seq); outbox.push(reading); }
+        uint32_t spooled = outbox.spool_depth();
+        uint32_t in_ram = outbox.depth() - spooled;
+        /** Half of the spool survives, the cut lands in the values of the next entry */
+        uint32_t keep = sizeof(OUTBOX_SPOOL_HEADER) + OUTBOX_ENTRY_LEN(10) * (spooled / 2) + sizeof(OUTBOX_ENTRY) + 8;
+        std::string path = native_path("sd") + OUTBOX_SPOOL;
+        check(truncate(path.c_str(), keep) == 0, "Spool truncated");
+
+        uint32_t count = 0;
+        uint32_t last = 0;
+        bool in_order = true;
+        while(outbox.peek(reading) && count < 2000)
+        {
+            if(reading.seq <= last) { in_order = false; }
+            last = reading.seq;
+            outbox.pop();
+            count++;
+        }
+        check(outbox.depth() == 0 && count == spooled / 2 + in_ram, "Bad spool records are skipped, replay drains");
+        check(outbox.stats().dropped == spooled - spooled / 2 && in_order && last == 1000, "Skipped records are counted");
+    }
+
+    std::string rm = std::string("rm -rf ") + run_dir;
+    if(system(rm.c_str()) != 0) { return 1; }
+    printf("%s\n", failures ? "FAILED" : "all ok");
+    return failures ? 1 : 0;
+}
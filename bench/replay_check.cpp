@@ -0,0 +1,229 @@
+/**
+ * @file replay_check.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host check of the offline outbox end to end, mqtt_publish() through outbox_replay()
+ * Runs the firmware's MQTT path against lib/hal_native's broker in a scratch directory,
+ * mqtt/down takes the broker away and mqtt/out.log is what it was sent
+ * g++ -O2 -std=gnu++17 -pthread -static-libstdc++ -DALLOC_COUNT -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ *     -I lib/hal_native/src -I src bench/replay_check.cpp followed by every .cpp in src
+ *     and every .cpp in lib/hal_native/src but native_main.cpp, -o replay_check
+ * @version 0.1
+ * @date 2023-10-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <Arduino.h>
+#include <MQTT.h>
+#include <PubSubClient.h>
+#include <SD.h>
+#include <encoder.h>
+#include <hal_native.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/** Firmware state, from main.cpp and MQTT.cpp */
+extern MQTT mqtt_lib;
+extern PubSubClient mqtt_client;
+extern char topic_base[];
+
+/** Readings queued while the broker is down */
+#define CHECK_OFFLINE 35
+/** Live readings while the backlog replays, one per CHECK_LIVE_TIME */
+#define CHECK_LIVE_TIME 250
+/** Give up on anything taking longer, ms */
+#define CHECK_TIMEOUT 20000
+
+/** Results go here, the firmware logs to stdout */
+static FILE* results;
+static uint32_t failures;
+
+static void check(bool ok, const char* what)
+{
+    fprintf(results, "%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if(!ok) { failures++; }
+}
+
+/**
+ * @brief Reading seq with a value pattern that ties the values to it
+ *
+ */
+static void make(READING &reading, uint32_t seq)
+{
+    reading.seq = seq;
+    reading.epoch = 1696200000 + seq;
+    reading.addr = 1 + seq % 4;
+    reading.msg = seq % 3;
+    reading.type = 0;
+    reading.scale = 0.1f;
+    reading.offset = 0;
+    reading.count = 4;
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        reading.raw[x] = seq * 16 + x;
+        reading.values[x] = reading.raw[x] * reading.scale;
+    }
+}
+
+/**
+ * @brief What the broker got, topic and payload per line
+ *
+ */
+struct SENT
+{
+    std::string topic;
+    std::string payload;
+};
+
+static std::vector<SENT> broker_log()
+{
+    std::vector<SENT> sent;
+    FILE* log = fopen(native_path("mqtt/out.log").c_str(), "r");
+    if(log == nullptr) { return sent; }
+    char line[4096];
+    while(fgets(line, sizeof(line), log) != nullptr)
+    {
+        std::string text = line;
+        while(!text.empty() && text.back() == '\n') { text.pop_back(); }
+        size_t split = text.find(' ');
+        if(split == std::string::npos) { continue; }
+        sent.push_back({text.substr(0, split), text.substr(split + 1)});
+    }
+    fclose(log);
+    return sent;
+}
+
+static bool ends_with(const std::string &text, const char* suffix)
+{
+    size_t len = strlen(suffix);
+    return text.size() >= len && text.compare(text.size() - len, len, suffix) == 0;
+}
+
+/**
+ * @brief Run the net task until the broker takes a connection
+ *
+ * @return false if it never did
+ */
+static bool wait_online()
+{
+    uint32_t start = millis();
+    while(!mqtt_client.connected())
+    {
+        if((millis() - start) >= CHECK_TIMEOUT) { return false; }
+        mqtt_lib.mqtt_loop();
+        delay(10);
+    }
+    return true;
+}
+
+int main()
+{
+    char run_dir[] = "/tmp/replay_check_XXXXXX";
+    if(mkdtemp(run_dir) == nullptr) { return 1; }
+    setenv("RS485_NATIVE_DIR", run_dir, 1);
+    /** Firmware console goes to /dev/null, results keep the real stdout */
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if(freopen("/dev/null", "w", stdout) == nullptr) { return 1; }
+    if(freopen("/dev/null", "w", stderr) == nullptr) { return 1; }
+
+    CSV = true;
+    payload_format = PAYLOAD_CSV;
+    batch_time = 0;
+    stats_time = 0;
+    SD.begin();
+    outbox.outbox_setup(true);
+    mqtt_lib.mqtt_setup();
+    check(wait_online(), "Broker connects");
+
+    /** Broker goes away, every reading is queued and nothing is sent */
+    std::string down = native_path("mqtt/down");
+    FILE* flag = fopen(down.c_str(), "w");
+    if(flag != nullptr) { fclose(flag); }
+    mqtt_lib.mqtt_loop();
+    size_t before = broker_log().size();
+    static READING reading;
+    for(uint32_t seq = 1; seq <= CHECK_OFFLINE; seq++)
+    {
+        make(reading, seq);
+        mqtt_lib.mqtt_publish(reading);
+        mqtt_lib.mqtt_loop();
+    }
+    check(outbox.depth() == CHECK_OFFLINE && broker_log().size() == before, "Offline readings are queued");
+
+    /** Broker is back, the backlog replays while live readings keep coming */
+    unlink(down.c_str());
+    check(wait_online(), "Broker reconnects");
+    uint32_t start = millis();
+    uint32_t last_live = start;
+    uint32_t live_seq = 1000;
+    uint32_t depth = outbox.depth();
+    std::vector<uint32_t> replay_times;
+    bool live_queued = false;
+    while(outbox.depth() > 0 && (millis() - start) < CHECK_TIMEOUT)
+    {
+        mqtt_lib.mqtt_loop();
+        for(; depth > outbox.depth(); depth--) { replay_times.push_back(millis()); }
+        if((millis() - last_live) >= CHECK_LIVE_TIME)
+        {
+            last_live = millis();
+            make(reading, live_seq++);
+            mqtt_lib.mqtt_publish(reading);
+            live_queued |= outbox.depth() > depth;
+        }
+        delay(5);
+    }
+    check(outbox.depth() == 0 && replay_times.size() == CHECK_OFFLINE, "Backlog drains");
+    check(!live_queued, "Live readings are not queued behind it");
+
+    /** No more than a batch in any batch time */
+    bool paced = true;
+    for(size_t x = OUTBOX_BATCH; x < replay_times.size(); x++)
+    {
+        if((replay_times[x] - replay_times[x - OUTBOX_BATCH]) < OUTBOX_BATCH_TIME - 10) { paced = false; }
+    }
+    uint32_t batches = (CHECK_OFFLINE + OUTBOX_BATCH - 1) / OUTBOX_BATCH;
+    paced &= !replay_times.empty() && (replay_times.back() - replay_times.front()) >= (batches - 1) * OUTBOX_BATCH_TIME - 10;
+    check(paced, "Replay is paced OUTBOX_BATCH per OUTBOX_BATCH_TIME");
+
+    /** Backlog in order on /backlog stamped with seq and epoch, live readings between the batches */
+    std::vector<SENT> sent = broker_log();
+    uint32_t next = 1;
+    bool intact = true;
+    size_t first_backlog = 0;
+    size_t last_backlog = 0;
+    bool live_between = false;
+    bool report = false;
+    static uint8_t expect[ENC_MAX_SIZE];
+    for(size_t x = before; x < sent.size(); x++)
+    {
+        const SENT &line = sent[x];
+        if(ends_with(line.topic, "/backlog"))
+        {
+            make(reading, next++);
+            ENC_WRITER out(expect, sizeof(expect));
+            encode_csv(reading, true, out);
+            std::string topic = topic_base + std::to_string(reading.addr) + "/backlog";
+            intact &= line.topic == topic && line.payload == std::string((const char*)expect, out.length());
+            if(first_backlog == 0) { first_backlog = x; }
+            last_backlog = x;
+        } else if(ends_with(line.topic, "/outbox")) {
+            report = line.payload.compare(0, 4, "0,0,") == 0;
+        }
+    }
+    for(size_t x = first_backlog; x < last_backlog; x++)
+    {
+        live_between |= !ends_with(sent[x].topic, "/backlog") && !ends_with(sent[x].topic, "/outbox");
+    }
+    check(next == CHECK_OFFLINE + 1 && intact, "Backlog is oldest first, each once, stamped");
+    check(live_between, "Live readings go out between replay batches");
+    check(report, "Outbox reports empty once drained");
+
+    std::string rm = std::string("rm -rf ") + run_dir;
+    if(system(rm.c_str()) != 0) { return 1; }
+    fprintf(results, "%s\n", failures ? "FAILED" : "all ok");
+    return failures ? 1 : 0;
+}
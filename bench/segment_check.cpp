@@ -0,0 +1,230 @@
+/**
+ * @file segment_check.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host check of the binary SD log, records packed into segments and read back
+ * Writes through write_sd() onto lib/hal_native's SD in a scratch directory, then walks
+ * every segment's block headers and unpacks the blocks the way a reader of the card would
+ * g++ -O2 -std=gnu++17 -pthread -static-libstdc++ -DALLOC_COUNT -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ *     -I lib/hal_native/src -I src bench/segment_check.cpp followed by every .cpp in src
+ *     and every .cpp in lib/hal_native/src but native_main.cpp, -o segment_check
+ * @version 0.1
+ * @date 2023-10-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include <crc16.h>
+#include <decode.h>
+#include <hal_native.h>
+#include <logger.h>
+#include <lz.h>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/** Firmware state, from main.cpp and logger.cpp */
+extern LOGGER logger_lib;
+extern File r4k_file;
+extern uint32_t seg_first;
+extern uint32_t seg_last;
+extern bool use_sd;
+void flush_sd();
+void segment_path(char* buf, size_t size, uint32_t num, uint8_t format);
+
+/** Readings before the restart, the last CHECK_NOISY of them do not compress */
+#define CHECK_BEFORE 2500
+#define CHECK_NOISY 500
+/** Readings after the restart */
+#define CHECK_AFTER 500
+/** Small segments so the log rolls a few times */
+#define CHECK_SEGMENT_KB 16
+
+/** Results go here, the firmware logs to stdout */
+static FILE* results;
+static uint32_t failures;
+
+static void check(bool ok, const char* what)
+{
+    fprintf(results, "%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if(!ok) { failures++; }
+}
+
+/**
+ * @brief Reading seq, counting values that pack well or 32 bit noise that does not
+ * The noise is seeded by seq so the reader can make it again
+ *
+ */
+static void make(READING &reading, uint32_t seq)
+{
+    bool noisy = seq > CHECK_BEFORE - CHECK_NOISY && seq <= CHECK_BEFORE;
+    std::mt19937 noise(seq);
+    reading.seq = seq;
+    reading.epoch = 1696200000 + seq;
+    reading.addr = 1 + seq % 5;
+    reading.msg = seq % 3;
+    reading.type = noisy ? REG_U32 : REG_U16;
+    reading.count = 10;
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        reading.raw[x] = noisy ? (int32_t)noise() : (int32_t)(seq * 16 + x);
+    }
+}
+
+/**
+ * @brief What the walk found
+ *
+ */
+struct WALK
+{
+    uint32_t next = 1;
+    uint32_t blocks = 0;
+    uint32_t packed = 0;
+    uint32_t stored = 0;
+    bool intact = true;
+    bool headers = true;
+    bool tails = true;
+    bool sizes = true;
+};
+
+/**
+ * @brief Records of one unpacked block, each must be the next reading
+ *
+ */
+static void walk_records(const uint8_t* data, size_t len, const LOG_BLOCK_HEADER &header, WALK &walk)
+{
+    static READING reading;
+    uint8_t slaves[sizeof(header.slaves)] = {};
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint16_t records = 0;
+    size_t pos = 0;
+    while(pos + sizeof(LOG_RECORD) <= len)
+    {
+        LOG_RECORD record;
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+        make(reading, walk.next++);
+        uint8_t width = record.type >= REG_U32 ? 4 : 2;
+        bool same = record.epoch == reading.epoch && record.addr == reading.addr && record.msg == reading.msg
+            && record.type == reading.type && record.count == reading.count && pos + record.count * width <= len;
+        for(uint16_t x = 0; same && x < record.count; x++)
+        {
+            uint32_t raw = 0;
+            for(uint8_t y = 0; y < width; y++) { raw |= (uint32_t)data[pos + x * width + y] << (8 * y); }
+            uint32_t want = width == 4 ? (uint32_t)reading.raw[x] : (uint16_t)reading.raw[x];
+            same = raw == want;
+        }
+        walk.intact &= same;
+        pos += record.count * width;
+        if(records == 0) { first = record.epoch; }
+        last = record.epoch;
+        records++;
+        slaves[record.addr / 8] |= 1 << (record.addr % 8);
+    }
+    walk.headers &= pos == len && records == header.records && first == header.first && last == header.last
+        && memcmp(slaves, header.slaves, sizeof(slaves)) == 0;
+}
+
+/**
+ * @brief Walk a segment from the front until the first bad header
+ * Everything after it must be the unwritten tail
+ *
+ */
+static void walk_segment(uint32_t num, WALK &walk)
+{
+    char path[24];
+    segment_path(path, sizeof(path), num, LOG_BINARY);
+    FILE* file = fopen((native_path("sd") + path).c_str(), "rb");
+    if(file == nullptr)
+    {
+        walk.intact = false;
+        return;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t got;
+    while((got = fread(chunk, 1, sizeof(chunk), file)) > 0) { data.insert(data.end(), chunk, chunk + got); }
+    fclose(file);
+    walk.sizes &= data.size() == CHECK_SEGMENT_KB * 1024;
+
+    static uint8_t raw[65536];
+    size_t pos = 0;
+    LOG_BLOCK_HEADER header;
+    while(pos + sizeof(header) <= data.size())
+    {
+        memcpy(&header, data.data() + pos, sizeof(header));
+        size_t skip = offsetof(LOG_BLOCK_HEADER, len);
+        if(header.magic != LOG_BLOCK_MAGIC || header.crc != crc16((uint8_t*)&header + skip, sizeof(header) - skip)) { break; }
+        if(pos + sizeof(header) + header.len > data.size()) { break; }
+        const uint8_t* block = data.data() + pos + sizeof(header);
+        if(header.len == header.raw_len)
+        {
+            memcpy(raw, block, header.len);
+            walk.stored++;
+        } else {
+            walk.intact &= lz_decompress(block, header.len, raw, sizeof(raw)) == header.raw_len;
+            walk.packed++;
+        }
+        walk_records(raw, header.raw_len, header, walk);
+        walk.blocks++;
+        pos += sizeof(header) + header.len;
+    }
+    for(; pos < data.size(); pos++) { walk.tails &= data[pos] == 0; }
+}
+
+int main()
+{
+    char run_dir[] = "/tmp/segment_check_XXXXXX";
+    if(mkdtemp(run_dir) == nullptr) { return 1; }
+    setenv("RS485_NATIVE_DIR", run_dir, 1);
+    /** Firmware console goes to /dev/null, results keep the real stdout */
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if(freopen("/dev/null", "w", stdout) == nullptr) { return 1; }
+    if(freopen("/dev/null", "w", stderr) == nullptr) { return 1; }
+
+    use_sd = true;
+    sd_format = LOG_BINARY;
+    sd_segment_kb = CHECK_SEGMENT_KB;
+    sd_budget_mb = 64;
+    logger_lib.logger_setup();
+    check(card_found, "SD found");
+
+    static READING reading;
+    for(uint32_t seq = 1; seq <= CHECK_BEFORE; seq++)
+    {
+        make(reading, seq);
+        logger_lib.write_sd(reading);
+    }
+    flush_sd();
+
+    /** Restart, the open segment is picked up after its last good block */
+    r4k_file.close();
+    seg_last = 0;
+    for(uint32_t seq = CHECK_BEFORE + 1; seq <= CHECK_BEFORE + CHECK_AFTER; seq++)
+    {
+        make(reading, seq);
+        logger_lib.write_sd(reading);
+    }
+    flush_sd();
+    r4k_file.close();
+
+    WALK walk;
+    for(uint32_t num = seg_first; num <= seg_last; num++) { walk_segment(num, walk); }
+    check(seg_last > seg_first, "Log rolls over segments");
+    check(walk.sizes, "Segments are preallocated to their size");
+    check(walk.packed > 0 && walk.stored > 0, "Blocks are packed, noise is stored as is");
+    check(walk.next == CHECK_BEFORE + CHECK_AFTER + 1 && walk.intact, "Every record unpacks in order, intact");
+    check(walk.headers, "Headers match their records");
+    check(walk.tails, "Walk stops at the unwritten tail");
+
+    std::string rm = std::string("rm -rf ") + run_dir;
+    if(system(rm.c_str()) != 0) { return 1; }
+    fprintf(results, "%s\n", failures ? "FAILED" : "all ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,486 @@
+/**
+ * @file slave_farm.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Simulated Modbus RTU slave farm and end to end cycle time benchmark
+ * Runs the env:native firmware against N simulated slaves on its RS485 pty
+ * at each baud rate and reports what one logger can poll
+ * pio run -e native
+ * g++ -O2 -std=gnu++17 -I src bench/slave_farm.cpp -o slave_farm
+ * ./slave_farm .pio/build/native/program [options]
+ * @version 0.1
+ * @date 2023-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <crc16.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+/** Registers in every slave map */
+#define FARM_MAP_SIZE 256
+/** Gap that ends a partial request, us */
+#define FARM_FRAME_GAP 20000
+
+/**
+ * @brief One simulated slave
+ *
+ */
+struct SLAVE_SIM
+{
+    uint8_t addr;
+    /** Registers polled, from 0 */
+    uint16_t regs;
+    /** Reply latency, normal, us */
+    double latency_mean;
+    double latency_sd;
+    /** Chance of one flipped bit per reply byte */
+    double noise;
+    /** Chance of not answering */
+    double drop;
+    /** Holding/input registers, drift a little every read */
+    uint16_t map[FARM_MAP_SIZE];
+};
+
+/**
+ * @brief Bench options
+ *
+ */
+struct FARM_OPTS
+{
+    const char* program = nullptr;
+    const char* farm_file = nullptr;
+    std::vector<uint32_t> bauds = {4800, 9600, 19200, 38400, 57600, 115200};
+    uint16_t slaves = 8;
+    uint16_t regs = 3;
+    double latency_mean = 5000;
+    double latency_sd = 1000;
+    double noise = 0;
+    double drop = 0;
+    /** Poll interval of every message, ms, 1 polls flat out */
+    uint32_t interval = 1;
+    double warmup = 2;
+    double seconds = 10;
+};
+
+/**
+ * @brief What the farm saw over the measured window
+ *
+ */
+struct FARM_STATS
+{
+    uint64_t requests = 0;
+    uint64_t replies = 0;
+    uint64_t dropped = 0;
+    uint64_t bad_requests = 0;
+    uint64_t wire_bytes = 0;
+    /** Time between polls of the same slave, us, all slaves and by address */
+    std::vector<double> cycles;
+    std::vector<double> slave_cycles[256];
+    uint64_t slave_polls[256] = {};
+    /** Time between consecutive requests on the bus, us */
+    std::vector<double> txns;
+};
+
+static std::mt19937 rng(12345);
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Wire time of n bytes, 11 bit characters as the firmware assumes
+ *
+ */
+static double wire_us(size_t bytes, uint32_t baud)
+{
+    return bytes * 11.0 * 1e6 / baud;
+}
+
+static double percentile(std::vector<double> &samples, double pct)
+{
+    if(samples.empty()) { return 0; }
+    size_t index = std::min(samples.size() - 1, (size_t)(pct / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+/**
+ * @brief Write a key the way hal_native Preferences stores it
+ *
+ */
+static void nvs_put(const std::string &dir, const std::string &key, const void* value, size_t len)
+{
+    FILE* file = fopen((dir + "/" + key).c_str(), "wb");
+    if(file == nullptr) { perror(key.c_str()); exit(1); }
+    fwrite(value, 1, len, file);
+    fclose(file);
+}
+
+/**
+ * @brief Fresh run directory with the baud rate and one read per slave preset
+ *
+ */
+static std::string prepare_run(const FARM_OPTS &opts, const std::vector<SLAVE_SIM> &farm, uint32_t baud)
+{
+    std::string run = "./farm_run/" + std::to_string(baud);
+    std::string rm = "rm -rf '" + run + "'";
+    if(system(rm.c_str()) != 0) { exit(1); }
+    std::string nvs = run + "/nvs/RS485";
+    std::string mk = "mkdir -p '" + nvs + "' '" + run + "/mqtt'";
+    if(system(mk.c_str()) != 0) { exit(1); }
+
+    nvs_put(nvs, "baud", &baud, sizeof(baud));
+    uint32_t rnum = farm.size();
+    nvs_put(nvs, "rnum", &rnum, sizeof(rnum));
+    for(size_t x = 0; x < farm.size(); x++)
+    {
+        uint8_t frame[8] = {farm[x].addr, 0x03, 0, 0, (uint8_t)(farm[x].regs >> 8), (uint8_t)farm[x].regs};
+        uint16_t crc = crc16(frame, 6);
+        frame[6] = crc & 0xFF;
+        frame[7] = crc >> 8;
+        std::string num = std::to_string(x + 1);
+        nvs_put(nvs, "msg" + num, frame, sizeof(frame));
+        nvs_put(nvs, "ivl" + num, &opts.interval, sizeof(opts.interval));
+    }
+    return run;
+}
+
+/**
+ * @brief Reply to one request, empty if the slave stays quiet
+ *
+ */
+static std::vector<uint8_t> slave_reply(SLAVE_SIM &slave, const uint8_t* req)
+{
+    std::vector<uint8_t> reply = {req[0], req[1]};
+    uint16_t start = (req[2] << 8) | req[3];
+    uint16_t count = (req[4] << 8) | req[5];
+    switch(req[1])
+    {
+        case 0x03:
+        case 0x04:
+            if(count == 0 || count > 125 || start + count > FARM_MAP_SIZE)
+            {
+                reply = {req[0], (uint8_t)(req[1] | 0x80), 0x02};
+                break;
+            }
+            reply.push_back(count * 2);
+            for(uint16_t x = start; x < start + count; x++)
+            {
+                slave.map[x] += (int)(rng() % 3) - 1;
+                reply.push_back(slave.map[x] >> 8);
+                reply.push_back(slave.map[x] & 0xFF);
+            }
+        break;
+        case 0x06:
+            if(start < FARM_MAP_SIZE) { slave.map[start] = count; }
+            reply.insert(reply.end(), req + 2, req + 6);
+        break;
+        default:
+            reply = {req[0], (uint8_t)(req[1] | 0x80), 0x01};
+        break;
+    }
+    uint16_t crc = crc16(reply.data(), reply.size());
+    reply.push_back(crc & 0xFF);
+    reply.push_back(crc >> 8);
+    return reply;
+}
+
+/**
+ * @brief CPU time of a process so far, us
+ *
+ */
+static double process_cpu_us(pid_t pid)
+{
+    std::string path = "/proc/" + std::to_string(pid) + "/stat";
+    FILE* file = fopen(path.c_str(), "r");
+    if(file == nullptr) { return 0; }
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+    /** Fields after the command name, utime and stime are 14 and 15 */
+    char* rest = strrchr(buf, ')');
+    if(rest == nullptr) { return 0; }
+    unsigned long utime = 0, stime = 0;
+    sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Start the firmware on a run directory, console to run/console.log
+ *
+ */
+static pid_t start_program(const char* program, const std::string &run)
+{
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        setenv("RS485_NATIVE_DIR", run.c_str(), 1);
+        unsetenv("RS485_PORT");
+        int log = open((run + "/console.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        execl(program, program, (char*)nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * @brief Serve the bus until the window closes
+ * Requests arrive at pty speed, each reply is held back by the request
+ * and reply wire time plus the slave latency so the engine sees real
+ * bus timing
+ *
+ */
+static void serve(int fd, std::vector<SLAVE_SIM> &farm, uint32_t baud, double measure_start, double end, FARM_STATS &stats)
+{
+    SLAVE_SIM* by_addr[256] = {};
+    for(SLAVE_SIM &slave : farm) { by_addr[slave.addr] = &slave; }
+    double last_poll[256] = {};
+    double last_request = 0;
+    uint8_t buf[512];
+    size_t len = 0;
+    double last_byte = 0;
+
+    while(now_us() < end)
+    {
+        struct pollfd wait = {fd, POLLIN, 0};
+        if(poll(&wait, 1, 10) <= 0) { continue; }
+        ssize_t got = read(fd, buf + len, sizeof(buf) - len);
+        if(got <= 0) { continue; }
+        double now = now_us();
+        if(len > 0 && now - last_byte > FARM_FRAME_GAP) { memmove(buf, buf + len, got); len = 0; }
+        len += got;
+        last_byte = now;
+
+        /** Function 15/16 carry a byte count, the rest are 8 bytes */
+        size_t need = 8;
+        if(len >= 7 && (buf[1] == 0x0F || buf[1] == 0x10)) { need = 9 + buf[6]; }
+        if(len < need) { continue; }
+
+        bool measured = now >= measure_start;
+        const uint8_t* req = buf;
+        uint16_t crc = crc16(req, need - 2);
+        bool good = (crc & 0xFF) == req[need - 2] && (crc >> 8) == req[need - 1];
+        double sent = now + wire_us(need, baud);
+        if(measured)
+        {
+            stats.requests++;
+            stats.wire_bytes += need;
+            if(last_request > 0) { stats.txns.push_back(now - last_request); }
+            if(good) { stats.slave_polls[req[0]]++; }
+            if(good && last_poll[req[0]] > 0)
+            {
+                stats.cycles.push_back(now - last_poll[req[0]]);
+                stats.slave_cycles[req[0]].push_back(now - last_poll[req[0]]);
+            }
+        }
+        last_request = now;
+        if(good) { last_poll[req[0]] = now; }
+
+        SLAVE_SIM* slave = good ? by_addr[req[0]] : nullptr;
+        if(!good && measured) { stats.bad_requests++; }
+        if(slave != nullptr && std::uniform_real_distribution<double>(0, 1)(rng) >= slave->drop)
+        {
+            std::vector<uint8_t> reply = slave_reply(*slave, req);
+            for(uint8_t &byte : reply)
+            {
+                if(std::uniform_real_distribution<double>(0, 1)(rng) < slave->noise) { byte ^= 1 << (rng() % 8); }
+            }
+            double latency = std::max(0.0, std::normal_distribution<double>(slave->latency_mean, slave->latency_sd)(rng));
+            double due = sent + latency + wire_us(reply.size(), baud);
+            double wait_us = due - now_us();
+            if(wait_us > 0) { std::this_thread::sleep_for(std::chrono::microseconds((long)wait_us)); }
+            if(write(fd, reply.data(), reply.size()) < 0) { perror("write"); }
+            if(measured)
+            {
+                stats.replies++;
+                stats.wire_bytes += reply.size();
+            }
+        } else if(slave != nullptr && measured) {
+            stats.dropped++;
+        }
+        len -= need;
+        memmove(buf, buf + need, len);
+    }
+}
+
+/**
+ * @brief One baud rate, start to finish
+ *
+ */
+static void run_baud(const FARM_OPTS &opts, std::vector<SLAVE_SIM> farm, uint32_t baud)
+{
+    std::string run = prepare_run(opts, farm, baud);
+    pid_t pid = start_program(opts.program, run);
+
+    /** Firmware links its pty once the bus starts */
+    std::string link = run + "/rs485";
+    int fd = -1;
+    for(int x = 0; x < 500 && fd < 0; x++)
+    {
+        fd = open(link.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(fd < 0) { usleep(10000); }
+    }
+    if(fd < 0)
+    {
+        fprintf(stderr, "%u: no pty at %s, see %s/console.log\n", baud, link.c_str(), run.c_str());
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    struct termios tio;
+    if(tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    FARM_STATS stats;
+    double start = now_us();
+    double measure_start = start + opts.warmup * 1e6;
+    double end = measure_start + opts.seconds * 1e6;
+    double cpu_start = 0;
+    std::thread sampler([&]
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds((long)(measure_start - now_us())));
+        cpu_start = process_cpu_us(pid);
+    });
+    serve(fd, farm, baud, measure_start, end, stats);
+    sampler.join();
+    double cpu = process_cpu_us(pid) - cpu_start;
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    close(fd);
+
+    double busy = wire_us(stats.wire_bytes, baud) / (opts.seconds * 1e6) * 100;
+    printf("%6u %8.1f %8.2f %8.2f %8.2f %8.2f %8.2f %7.1f %7.1f %8llu %8.1f %6.1f%% %6llu %6llu\n",
+        baud, stats.requests / opts.seconds,
+        percentile(stats.cycles, 50) / 1000, percentile(stats.cycles, 90) / 1000,
+        percentile(stats.cycles, 99) / 1000, stats.cycles.empty() ? 0 : *std::max_element(stats.cycles.begin(), stats.cycles.end()) / 1000,
+        percentile(stats.txns, 50) / 1000, stats.requests ? (double)stats.wire_bytes / stats.requests : 0,
+        stats.requests ? cpu / stats.requests : 0, (unsigned long long)stats.wire_bytes,
+        opts.seconds > 0 ? stats.wire_bytes / opts.seconds : 0, busy,
+        (unsigned long long)stats.dropped, (unsigned long long)stats.bad_requests);
+
+    /** Same columns per slave, polls/s and its own cycle times */
+    for(const SLAVE_SIM &slave : farm)
+    {
+        std::vector<double> &cycles = stats.slave_cycles[slave.addr];
+        char name[8];
+        snprintf(name, sizeof(name), "s%u", (unsigned)slave.addr);
+        printf("%6s %8.1f %8.2f %8.2f %8.2f %8.2f\n", name, stats.slave_polls[slave.addr] / opts.seconds,
+            percentile(cycles, 50) / 1000, percentile(cycles, 90) / 1000, percentile(cycles, 99) / 1000,
+            cycles.empty() ? 0 : *std::max_element(cycles.begin(), cycles.end()) / 1000);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Farm from a file, one slave per line
+ * addr regs latency_mean_us latency_sd_us noise drop
+ *
+ */
+static std::vector<SLAVE_SIM> load_farm(const FARM_OPTS &opts)
+{
+    std::vector<SLAVE_SIM> farm;
+    if(opts.farm_file == nullptr)
+    {
+        for(uint16_t x = 0; x < opts.slaves; x++)
+        {
+            farm.push_back({(uint8_t)(x + 1), opts.regs, opts.latency_mean, opts.latency_sd, opts.noise, opts.drop, {}});
+        }
+    } else {
+        FILE* file = fopen(opts.farm_file, "r");
+        if(file == nullptr) { perror(opts.farm_file); exit(1); }
+        char line[256];
+        while(fgets(line, sizeof(line), file) != nullptr)
+        {
+            unsigned addr, regs;
+            SLAVE_SIM slave = {};
+            if(line[0] == '#') { continue; }
+            if(sscanf(line, "%u %u %lf %lf %lf %lf", &addr, &regs, &slave.latency_mean, &slave.latency_sd, &slave.noise, &slave.drop) != 6) { continue; }
+            if(addr < 1 || addr > 247 || regs < 1 || regs > 125) { continue; }
+            slave.addr = addr;
+            slave.regs = regs;
+            farm.push_back(slave);
+        }
+        fclose(file);
+    }
+    /** Each slave gets its own map */
+    for(SLAVE_SIM &slave : farm)
+    {
+        for(int x = 0; x < FARM_MAP_SIZE; x++) { slave.map[x] = slave.addr * 1000 + x * 10; }
+    }
+    return farm;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "slave_farm PROGRAM [--slaves N] [--regs N] [--latency MEAN_US,SD_US] [--noise P] [--drop P]\n"
+        "                   [--interval MS] [--bauds 4800,9600,...] [--seconds S] [--warmup S] [--farm FILE]\n"
+        "FILE has one slave per line: addr regs latency_mean_us latency_sd_us noise drop\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    FARM_OPTS opts;
+    for(int x = 1; x < argc; x++)
+    {
+        std::string arg = argv[x];
+        const char* value = x + 1 < argc ? argv[x + 1] : nullptr;
+        if(arg[0] != '-') { opts.program = argv[x]; continue; }
+        if(value == nullptr) { usage(); }
+        x++;
+        if(arg == "--slaves") { opts.slaves = atoi(value); }
+        else if(arg == "--regs") { opts.regs = atoi(value); }
+        else if(arg == "--latency") { sscanf(value, "%lf,%lf", &opts.latency_mean, &opts.latency_sd); }
+        else if(arg == "--noise") { opts.noise = atof(value); }
+        else if(arg == "--drop") { opts.drop = atof(value); }
+        else if(arg == "--interval") { opts.interval = atoi(value); }
+        else if(arg == "--seconds") { opts.seconds = atof(value); }
+        else if(arg == "--warmup") { opts.warmup = atof(value); }
+        else if(arg == "--farm") { opts.farm_file = value; }
+        else if(arg == "--bauds")
+        {
+            opts.bauds.clear();
+            for(char* tok = strtok(argv[x], ","); tok != nullptr; tok = strtok(nullptr, ",")) { opts.bauds.push_back(atoi(tok)); }
+        }
+        else { usage(); }
+    }
+    if(opts.program == nullptr || opts.seconds <= 0) { usage(); }
+    if(opts.slaves < 1 || opts.slaves > 247 || opts.regs < 1 || opts.regs > 125) { usage(); }
+
+    std::vector<SLAVE_SIM> farm = load_farm(opts);
+    if(farm.empty()) { usage(); }
+    printf("%zu slaves, poll interval %ums, %.0fs per baud\n", farm.size(), opts.interval, opts.seconds);
+    printf("%6s %8s %8s %8s %8s %8s %8s %7s %7s %8s %8s %7s %6s %6s\n",
+        "baud", "tx/s", "cyc_p50", "cyc_p90", "cyc_p99", "cyc_max", "txn_p50", "B/tx", "cpu_us", "wire_B", "B/s", "busy", "drop", "badreq");
+    for(uint32_t baud : opts.bauds)
+    {
+        run_baud(opts, farm, baud);
+    }
+    return 0;
+}
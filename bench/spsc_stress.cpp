@@ -0,0 +1,66 @@
+/**
+ * @file spsc_stress.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Host stress check for the task to task reading ring
+ * g++ -O2 -std=gnu++17 -pthread -I src bench/spsc_stress.cpp -o spsc_stress
+ * @version 0.1
+ * @date 2023-09-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <spsc_ring.h>
+#include <reading.h>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+/** Same shape as the firmware's reading_ring */
+static SPSC_RING<READING, 16> ring;
+
+int main()
+{
+    const uint32_t total = 2000000;
+    uint32_t errors = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    /** RS485 task stand in, fills slots in place */
+    std::thread producer([&]()
+    {
+        for(uint32_t x = 1; x <= total; x++)
+        {
+            READING* slot;
+            while((slot = ring.claim()) == nullptr) { std::this_thread::yield(); }
+            slot->seq = x;
+            slot->count = 1 + x % READING_MAX_VALUES;
+            slot->values[0] = x;
+            slot->values[slot->count - 1] = x;
+            ring.commit();
+        }
+    });
+
+    /** Network task stand in, must see every record once, in order, whole */
+    std::thread consumer([&]()
+    {
+        uint32_t expect = 1;
+        while(expect <= total)
+        {
+            READING* next = ring.front();
+            if(next == nullptr)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if(next->seq != expect || next->values[0] != (float)expect || next->values[next->count - 1] != (float)expect) { errors++; }
+            expect++;
+            ring.release();
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%u records, %u errors, %.0f records/s\n", total, errors, total / took);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file Arduino.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Arduino-ESP32 core subset for env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __Arduino_H__
+#define __Arduino_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <WString.h>
+#include <freertos_native.h>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+/** RAK11200 IO2, powers the RS485 module */
+#define WB_IO2 2
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+inline void pinMode(uint8_t pin, uint8_t mode) { }
+inline void digitalWrite(uint8_t pin, uint8_t value) { }
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+void configTime(long gmt_offset, int dst_offset, const char* server);
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+
+/**
+ * @brief Console and UART stand in
+ * 
+ */
+class HardwareSerial
+{
+    public:
+    explicit HardwareSerial(FILE* out) : out(out) {}
+    void begin(unsigned long baud) { }
+    void setRxBufferSize(size_t size) { }
+    operator bool() const { return true; }
+    size_t print(const char* text) { return fputs(text, out) >= 0 ? strlen(text) : 0; }
+    size_t print(const String &text) { return print(text.c_str()); }
+    size_t println(const char* text) { size_t len = print(text); fputc('\n', out); return len + 1; }
+    size_t println(const String &text) { return println(text.c_str()); }
+
+    private:
+    FILE* out;
+};
+
+extern HardwareSerial Serial;
+/** UART behind RS485, only its driver settings are used */
+extern HardwareSerial Serial1;
+#define SERIAL_PORT_HARDWARE Serial1
+
+/**
+ * @brief Chip level calls
+ * 
+ */
+class EspClass
+{
+    public:
+    /** Runs the shutdown handlers and execs the program again */
+    void restart();
+    /** Free bytes in the malloc arena, the host has no fixed heap */
+    uint32_t getFreeHeap();
+    uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+};
+
+extern EspClass ESP;
+
+#endif
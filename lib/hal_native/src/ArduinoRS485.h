@@ -0,0 +1,52 @@
+/**
+ * @file ArduinoRS485.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief RS485 for env:native, a pty or an existing tty
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __ArduinoRS485_H__
+#define __ArduinoRS485_H__
+
+#include <Arduino.h>
+
+/**
+ * @brief Half duplex bus over a host serial device
+ * begin() opens RS485_PORT if set, otherwise a new pty whose
+ * other end is linked at <native dir>/rs485 for a simulator
+ * 
+ */
+class RS485Class
+{
+    public:
+    void begin(unsigned long baud);
+    void end();
+    void beginTransmission() { }
+    void endTransmission() { }
+    void receive() { }
+    void noReceive() { }
+    int available();
+    int read();
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* data, size_t len);
+
+    /** Bytes moved, for benchmarks */
+    uint64_t tx_bytes = 0;
+    uint64_t rx_bytes = 0;
+
+    private:
+    int fd = -1;
+    /** Pty slave kept open so the master never reads EIO while no peer is attached */
+    int hold_fd = -1;
+    uint8_t rx_buf[256];
+    int rx_len = 0;
+    int rx_pos = 0;
+};
+
+extern RS485Class RS485;
+
+#endif
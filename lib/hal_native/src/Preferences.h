@@ -0,0 +1,54 @@
+/**
+ * @file Preferences.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief NVS Preferences over one file per key, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __Preferences_H__
+#define __Preferences_H__
+
+#include <Arduino.h>
+#include <string>
+
+/**
+ * @brief Keys live in <native dir>/nvs/<namespace>/<key>
+ * Values are stored as their raw bytes, like NVS blobs
+ * 
+ */
+class Preferences
+{
+    public:
+    bool begin(const char* name, bool read_only = false);
+    void end() { }
+    bool remove(const char* key);
+    bool clear();
+    bool isKey(const char* key);
+
+    size_t putBool(const char* key, bool value) { uint8_t raw = value; return putBytes(key, &raw, 1); }
+    size_t putUChar(const char* key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putULong64(const char* key, uint64_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putBytes(const char* key, const void* value, size_t len);
+
+    bool getBool(const char* key, bool value = false) { uint8_t raw = value; get(key, &raw, 1); return raw; }
+    uint8_t getUChar(const char* key, uint8_t value = 0) { get(key, &value, sizeof(value)); return value; }
+    int32_t getInt(const char* key, int32_t value = 0) { get(key, &value, sizeof(value)); return value; }
+    uint32_t getUInt(const char* key, uint32_t value = 0) { get(key, &value, sizeof(value)); return value; }
+    uint64_t getULong64(const char* key, uint64_t value = 0) { get(key, &value, sizeof(value)); return value; }
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buf, size_t len);
+
+    private:
+    /** Reads exactly len bytes or leaves value alone */
+    void get(const char* key, void* value, size_t len);
+    std::string path(const char* key) const;
+    std::string dir;
+};
+
+#endif
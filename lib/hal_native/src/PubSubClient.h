@@ -0,0 +1,71 @@
+/**
+ * @file PubSubClient.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief PubSubClient API over a file backed broker stand-in, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __PubSubClient_H__
+#define __PubSubClient_H__
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include <string>
+#include <vector>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+/** Fixed header and topic length bytes, as the real client counts them */
+#define MQTT_MAX_HEADER_SIZE 5
+
+typedef void (*MQTT_CALLBACK_SIGNATURE)(char*, uint8_t*, unsigned int);
+
+/**
+ * @brief Same calls and buffer limit as PubSubClient 2.8
+ * Publishes go to <native dir>/mqtt/out.log one line each,
+ * "topic payload" with bytes outside printable ASCII as \xHH.
+ * Lines of <native dir>/mqtt/in are delivered as downlinks.
+ * While <native dir>/mqtt/down exists the broker is unreachable.
+ * 
+ */
+class PubSubClient
+{
+    public:
+    explicit PubSubClient(WiFiClientSecure &client) { }
+    PubSubClient& setServer(const char* host, uint16_t port) { return *this; }
+    PubSubClient& setKeepAlive(uint16_t seconds) { return *this; }
+    PubSubClient& setSocketTimeout(uint16_t seconds) { return *this; }
+    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE callback) { this->callback = callback; return *this; }
+    bool setBufferSize(uint16_t size) { buffer_size = size; return true; }
+    uint16_t getBufferSize() { return buffer_size; }
+
+    bool connect(const char* id, const char* user, const char* pass);
+    void disconnect() { link = false; }
+    bool connected();
+    bool loop();
+    int state() { return link ? MQTT_CONNECTED : last_state; }
+    bool subscribe(const char* topic);
+    bool publish(const char* topic, const char* payload) { return publish(topic, (const uint8_t*)payload, strlen(payload)); }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int len);
+
+    /** Publishes accepted and their payload bytes, for benchmarks */
+    uint64_t published = 0;
+    uint64_t published_bytes = 0;
+
+    private:
+    bool broker_up();
+
+    MQTT_CALLBACK_SIGNATURE callback = nullptr;
+    uint16_t buffer_size = 256;
+    bool link = false;
+    int last_state = MQTT_DISCONNECTED;
+    std::vector<std::string> topics;
+    FILE* out = nullptr;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file SD.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief SD card API over a host directory, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __SD_H__
+#define __SD_H__
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+struct FILE_NATIVE;
+
+/**
+ * @brief File or directory on the card, shared like the ESP32 FS handle
+ * 
+ */
+class File
+{
+    public:
+    File() {}
+    explicit File(std::shared_ptr<FILE_NATIVE> impl) : impl(impl) {}
+    operator bool() const;
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* data, size_t len);
+    int read();
+    int read(uint8_t* data, size_t len);
+    int available();
+    bool seek(uint32_t pos);
+    size_t position();
+    size_t size();
+    void flush();
+    void close();
+    const char* name() const;
+    bool isDirectory() const;
+    File openNextFile(const char* mode = FILE_READ);
+    size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t println(const char* text) { return print(text) + print("\r\n"); }
+
+    private:
+    std::shared_ptr<FILE_NATIVE> impl;
+};
+
+/**
+ * @brief The card, rooted at <native dir>/sd
+ * 
+ */
+class SDFS
+{
+    public:
+    bool begin();
+    File open(const char* path, const char* mode = FILE_READ, bool create = false);
+    bool exists(const char* path);
+    bool remove(const char* path);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+};
+
+extern SDFS SD;
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * @file SPI.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Nothing to set up, SD is a directory on env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __SPI_H__
+#define __SPI_H__
+
+#endif
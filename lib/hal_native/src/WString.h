@@ -0,0 +1,66 @@
+/**
+ * @file WString.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Arduino String subset for env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __WString_H__
+#define __WString_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/**
+ * @brief Arduino String over std::string
+ * Numbers format as the ESP32 core does, floats with 2 decimals
+ * 
+ */
+class String
+{
+    public:
+    String() {}
+    String(const char* text) : text(text ? text : "") {}
+    String(const std::string &text) : text(text) {}
+    explicit String(char value) : text(1, value) {}
+    explicit String(int value) : text(std::to_string(value)) {}
+    explicit String(unsigned int value) : text(std::to_string(value)) {}
+    explicit String(long value) : text(std::to_string(value)) {}
+    explicit String(unsigned long value) : text(std::to_string(value)) {}
+    explicit String(long long value) : text(std::to_string(value)) {}
+    explicit String(unsigned long long value) : text(std::to_string(value)) {}
+    explicit String(unsigned char value) : text(std::to_string(value)) {}
+    explicit String(float value, unsigned int decimals = 2) : String((double)value, decimals) {}
+    explicit String(double value, unsigned int decimals = 2)
+    {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        text = buf;
+    }
+
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    long toInt() const { return atol(text.c_str()); }
+    float toFloat() const { return atof(text.c_str()); }
+
+    String& operator+=(const String &other) { text += other.text; return *this; }
+    String& operator+=(const char* other) { text += other; return *this; }
+    String& operator+=(char other) { text += other; return *this; }
+    bool operator==(const String &other) const { return text == other.text; }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator!=(const String &other) const { return text != other.text; }
+
+    friend String operator+(const String &left, const String &right) { return String(left.text + right.text); }
+    friend String operator+(const String &left, const char* right) { return String(left.text + right); }
+    friend String operator+(const char* left, const String &right) { return String(left + right.text); }
+
+    private:
+    std::string text;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file WiFi.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief WiFi for env:native, the host is always on the network
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __WiFi_H__
+#define __WiFi_H__
+
+#include <Arduino.h>
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+/**
+ * @brief Host address
+ * 
+ */
+class IPAddress
+{
+    public:
+    String toString() const { return "127.0.0.1"; }
+};
+
+/**
+ * @brief Station calls the firmware makes
+ * 
+ */
+class WiFiClass
+{
+    public:
+    bool setHostname(const char* name) { return true; }
+    wl_status_t begin(const char* ssid, const char* pass) { return WL_CONNECTED; }
+    bool disconnect(bool off = false) { return true; }
+    wl_status_t status() { return WL_CONNECTED; }
+    IPAddress localIP() { return IPAddress(); }
+};
+
+extern WiFiClass WiFi;
+
+#endif
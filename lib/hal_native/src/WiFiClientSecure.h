@@ -0,0 +1,29 @@
+/**
+ * @file WiFiClientSecure.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief TLS client for env:native, the broker stand-in needs no socket
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __WiFiClientSecure_H__
+#define __WiFiClientSecure_H__
+
+#include <Arduino.h>
+
+/**
+ * @brief Settings only
+ * 
+ */
+class WiFiClientSecure
+{
+    public:
+    void setCACert(const char* cert) { }
+    void setHandshakeTimeout(unsigned long seconds) { }
+    void setTimeout(uint32_t seconds) { }
+};
+
+#endif
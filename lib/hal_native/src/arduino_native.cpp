@@ -0,0 +1,165 @@
+/**
+ * @file arduino_native.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Arduino core, FreeRTOS and entry point for env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_system.h>
+#include <hal_native.h>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <malloc.h>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HardwareSerial Serial(stdout);
+HardwareSerial Serial1(stderr);
+WiFiClass WiFi;
+EspClass ESP;
+
+/** Process start, millis() and micros() count from here */
+static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+static std::mt19937 rng(std::random_device{}());
+static std::mutex rng_lock;
+/** Offset configTime() asked for */
+static long time_offset;
+static std::vector<shutdown_handler_t> shutdown_handlers;
+static char** saved_argv;
+
+uint32_t millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+uint32_t micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+void delay(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+long random(long max)
+{
+    if(max <= 0) { return 0; }
+    std::lock_guard<std::mutex> guard(rng_lock);
+    return std::uniform_int_distribution<long>(0, max - 1)(rng);
+}
+
+long random(long min, long max)
+{
+    if(max <= min) { return min; }
+    return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed)
+{
+    std::lock_guard<std::mutex> guard(rng_lock);
+    rng.seed(seed);
+}
+
+/**
+ * @brief The host clock is already synced, keep the offsets
+ * 
+ */
+void configTime(long gmt_offset, int dst_offset, const char* server)
+{
+    time_offset = gmt_offset + dst_offset;
+}
+
+bool getLocalTime(struct tm* info, uint32_t ms)
+{
+    time_t now = time(nullptr) + time_offset;
+    return gmtime_r(&now, info) != nullptr;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    shutdown_handlers.push_back(handler);
+    return ESP_OK;
+}
+
+void native_args(char** argv)
+{
+    saved_argv = argv;
+}
+
+/**
+ * @brief Same as a reset on the device, state comes back from nvs/ and sd/
+ * 
+ */
+void EspClass::restart()
+{
+    for(shutdown_handler_t handler : shutdown_handlers) { handler(); }
+    fflush(nullptr);
+    execv("/proc/self/exe", saved_argv);
+    perror("execv");
+    exit(1);
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    return mallinfo2().fordblks;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack, void* param,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+    std::thread thread(task, param);
+    if(handle != nullptr) { *handle = (TaskHandle_t)(uintptr_t)std::hash<std::thread::id>()(thread.get_id()); }
+    thread.detach();
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return (TaskHandle_t)(uintptr_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+const std::string& native_dir()
+{
+    static const std::string dir = []
+    {
+        const char* env = getenv("RS485_NATIVE_DIR");
+        std::string path = env != nullptr && env[0] != '\0' ? env : "./native_run";
+        while(path.size() > 1 && path.back() == '/') { path.pop_back(); }
+        mkdir(path.c_str(), 0755);
+        return path;
+    }();
+    return dir;
+}
+
+std::string native_path(const std::string &rel)
+{
+    std::string path = native_dir();
+    /** Create each parent directory on the way */
+    size_t pos = 0;
+    while((pos = rel.find('/', pos)) != std::string::npos)
+    {
+        if(pos > 0) { mkdir((path + "/" + rel.substr(0, pos)).c_str(), 0755); }
+        pos++;
+    }
+    return path + "/" + rel;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file esp_attr.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Section attributes for env:native
+ * @version 0.1
+ * @date 2023-10-17
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __esp_attr_H__
+#define __esp_attr_H__
+
+/** Plain memory, ESP.restart() re-execs so nothing survives it on a host */
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#endif
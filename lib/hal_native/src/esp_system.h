@@ -0,0 +1,23 @@
+/**
+ * @file esp_system.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief ESP-IDF shutdown hooks for env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __esp_system_H__
+#define __esp_system_H__
+
+typedef int esp_err_t;
+typedef void (*shutdown_handler_t)(void);
+
+#define ESP_OK 0
+#define ESP_ERR_NO_MEM 0x101
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file FreeRTOS.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief FreeRTOS include for env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __FreeRTOS_H__
+#define __FreeRTOS_H__
+
+#include <freertos_native.h>
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * @file freertos_native.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief FreeRTOS task calls for env:native, tasks are std::threads
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __freertos_native_H__
+#define __freertos_native_H__
+
+#include <stdint.h>
+
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdPASS 1
+#define pdFAIL 0
+/** 1 kHz tick, as the ESP32 Arduino build */
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack, void* param,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * @file hal_native.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Run directory for the env:native HAL
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __hal_native_H__
+#define __hal_native_H__
+
+#include <string>
+
+/**
+ * Linux side of the HAL
+ * 
+ * The firmware talks to the hardware through the Arduino-ESP32,
+ * ArduinoRS485, PubSubClient, SD and Preferences APIs. On the device
+ * those are the real libraries; for env:native this library supplies
+ * the same API subset over Linux:
+ * 
+ *   RS485        a pty, or the tty named by RS485_PORT
+ *   PubSubClient a broker stand-in, publishes appended to mqtt/out.log,
+ *                downlinks read from mqtt/in as "topic payload" lines,
+ *                while mqtt/down exists the broker is unreachable
+ *   SD           files under sd/
+ *   Preferences  one file per key under nvs/<namespace>/
+ * 
+ * All under RS485_NATIVE_DIR, default ./native_run
+ * 
+ */
+
+/** Root of the native run directory, no trailing slash */
+const std::string& native_dir();
+/** Path under the native run directory */
+std::string native_path(const std::string &rel);
+/** Command line ESP.restart() runs again */
+void native_args(char** argv);
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file native_main.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief Entry point for env:native, runs setup() and loop() like the Arduino core
+ * Kept on its own so host benches can link the HAL with their own main()
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <Arduino.h>
+#include <hal_native.h>
+#include <chrono>
+#include <thread>
+
+void setup();
+void loop();
+
+int main(int argc, char** argv)
+{
+    native_args(argv);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    setup();
+    for(;;)
+    {
+        loop();
+        /** The device spins here, a host shares its cores, 100us is well under a Modbus silence */
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
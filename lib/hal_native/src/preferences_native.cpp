@@ -0,0 +1,86 @@
+/**
+ * @file preferences_native.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief NVS Preferences over a host directory, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <Preferences.h>
+#include <hal_native.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool Preferences::begin(const char* name, bool read_only)
+{
+    dir = native_path(std::string("nvs/") + name + "/");
+    return true;
+}
+
+std::string Preferences::path(const char* key) const
+{
+    return dir + key;
+}
+
+bool Preferences::remove(const char* key)
+{
+    return unlink(path(key).c_str()) == 0;
+}
+
+bool Preferences::clear()
+{
+    DIR* keys = opendir(dir.c_str());
+    if(keys == nullptr) { return false; }
+    struct dirent* entry;
+    while((entry = readdir(keys)) != nullptr)
+    {
+        if(entry->d_name[0] != '.') { unlink(path(entry->d_name).c_str()); }
+    }
+    closedir(keys);
+    return true;
+}
+
+bool Preferences::isKey(const char* key)
+{
+    return access(path(key).c_str(), F_OK) == 0;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len)
+{
+    /** Written aside and renamed so a kill mid write keeps the old value, as NVS does */
+    std::string final_path = path(key);
+    std::string temp_path = final_path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if(file == nullptr) { return 0; }
+    size_t put = fwrite(value, 1, len, file);
+    fclose(file);
+    if(put != len || rename(temp_path.c_str(), final_path.c_str()) != 0) { return 0; }
+    return put;
+}
+
+size_t Preferences::getBytesLength(const char* key)
+{
+    struct stat info;
+    return stat(path(key).c_str(), &info) == 0 ? info.st_size : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t len)
+{
+    size_t stored = getBytesLength(key);
+    if(stored == 0 || stored > len) { return 0; }
+    FILE* file = fopen(path(key).c_str(), "rb");
+    if(file == nullptr) { return 0; }
+    size_t got = fread(buf, 1, stored, file);
+    fclose(file);
+    return got;
+}
+
+void Preferences::get(const char* key, void* value, size_t len)
+{
+    if(getBytesLength(key) != len) { return; }
+    getBytes(key, value, len);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file pubsub_native.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief File backed broker stand-in, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <PubSubClient.h>
+#include <hal_native.h>
+#include <unistd.h>
+
+bool PubSubClient::broker_up()
+{
+    return access(native_path("mqtt/down").c_str(), F_OK) != 0;
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass)
+{
+    if(!broker_up())
+    {
+        last_state = MQTT_CONNECTION_TIMEOUT;
+        return false;
+    }
+    if(out == nullptr) { out = fopen(native_path("mqtt/out.log").c_str(), "a"); }
+    topics.clear();
+    link = out != nullptr;
+    last_state = link ? MQTT_CONNECTED : MQTT_DISCONNECTED;
+    return link;
+}
+
+bool PubSubClient::connected()
+{
+    if(link && !broker_up())
+    {
+        link = false;
+        last_state = MQTT_CONNECTION_TIMEOUT;
+    }
+    return link;
+}
+
+bool PubSubClient::subscribe(const char* topic)
+{
+    if(!connected()) { return false; }
+    topics.push_back(topic);
+    return true;
+}
+
+/**
+ * @brief Deliver the lines of mqtt/in then empty it
+ * 
+ */
+bool PubSubClient::loop()
+{
+    if(!connected()) { return false; }
+    std::string path = native_path("mqtt/in");
+    FILE* in = fopen(path.c_str(), "r");
+    if(in == nullptr) { return true; }
+    char line[1024];
+    std::vector<std::string> lines;
+    while(fgets(line, sizeof(line), in) != nullptr) { lines.push_back(line); }
+    fclose(in);
+    truncate(path.c_str(), 0);
+
+    for(std::string &text : lines)
+    {
+        while(!text.empty() && (text.back() == '\n' || text.back() == '\r')) { text.pop_back(); }
+        size_t split = text.find(' ');
+        if(split == std::string::npos || callback == nullptr) { continue; }
+        std::string topic = text.substr(0, split);
+        bool wanted = false;
+        for(const std::string &sub : topics) { wanted |= sub == topic; }
+        if(!wanted) { continue; }
+        std::string payload = text.substr(split + 1);
+        callback((char*)topic.c_str(), (uint8_t*)payload.data(), payload.size());
+    }
+    return true;
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int len)
+{
+    if(!connected()) { return false; }
+    /** Same check as the real client, fixed header, topic length and topic ahead of the payload */
+    if(MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + len > buffer_size) { return false; }
+    fputs(topic, out);
+    fputc(' ', out);
+    for(unsigned int x = 0; x < len; x++)
+    {
+        if(payload[x] >= 0x20 && payload[x] < 0x7F && payload[x] != '\\') { fputc(payload[x], out); }
+        else { fprintf(out, "\\x%02X", payload[x]); }
+    }
+    fputc('\n', out);
+    fflush(out);
+    published++;
+    published_bytes += len;
+    return true;
+}
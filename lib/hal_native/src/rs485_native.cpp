@@ -0,0 +1,110 @@
+/**
+ * @file rs485_native.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief RS485 over a pty or tty, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <ArduinoRS485.h>
+#include <hal_native.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+RS485Class RS485;
+
+/**
+ * @brief Termios speed for a baud rate, 9600 if unknown
+ * 
+ */
+static speed_t tty_speed(unsigned long baud)
+{
+    switch(baud)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default: return B9600;
+    }
+}
+
+void RS485Class::begin(unsigned long baud)
+{
+    end();
+    const char* port = getenv("RS485_PORT");
+    if(port != nullptr && port[0] != '\0')
+    {
+        fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(fd < 0) { perror(port); return; }
+    } else
+    {
+        fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) { perror("posix_openpt"); return; }
+        const char* name = ptsname(fd);
+        hold_fd = open(name, O_RDWR | O_NOCTTY);
+        std::string link = native_path("rs485");
+        unlink(link.c_str());
+        if(symlink(name, link.c_str()) != 0) { perror("symlink"); }
+        printf("[RS485] %s linked at %s\n", name, link.c_str());
+    }
+
+    struct termios tio;
+    int tty = hold_fd >= 0 ? hold_fd : fd;
+    if(tcgetattr(tty, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, tty_speed(baud));
+        cfsetospeed(&tio, tty_speed(baud));
+        tcsetattr(tty, TCSANOW, &tio);
+    }
+}
+
+void RS485Class::end()
+{
+    if(fd >= 0) { close(fd); }
+    if(hold_fd >= 0) { close(hold_fd); }
+    fd = hold_fd = -1;
+    rx_len = rx_pos = 0;
+}
+
+int RS485Class::available()
+{
+    if(rx_pos < rx_len) { return rx_len - rx_pos; }
+    if(fd < 0) { return 0; }
+    ssize_t got = ::read(fd, rx_buf, sizeof(rx_buf));
+    rx_pos = 0;
+    rx_len = got > 0 ? got : 0;
+    rx_bytes += rx_len;
+    return rx_len;
+}
+
+int RS485Class::read()
+{
+    if(available() == 0) { return -1; }
+    return rx_buf[rx_pos++];
+}
+
+size_t RS485Class::write(const uint8_t* data, size_t len)
+{
+    if(fd < 0) { return 0; }
+    size_t sent = 0;
+    while(sent < len)
+    {
+        ssize_t put = ::write(fd, data + sent, len - sent);
+        if(put > 0) { sent += put; continue; }
+        if(put < 0 && errno != EAGAIN) { break; }
+        /** Nothing is draining our own pty, the bus has no listener */
+        if(hold_fd >= 0) { tcflush(hold_fd, TCIFLUSH); } else { usleep(100); }
+    }
+    tx_bytes += sent;
+    return sent;
+}
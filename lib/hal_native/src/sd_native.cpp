@@ -0,0 +1,176 @@
+/**
+ * @file sd_native.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief SD card over a host directory, env:native
+ * @version 0.1
+ * @date 2023-10-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <SD.h>
+#include <hal_native.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SDFS SD;
+
+/**
+ * @brief Open file or directory behind a File
+ * 
+ */
+struct FILE_NATIVE
+{
+    std::string path;
+    std::string name;
+    FILE* file = nullptr;
+    DIR* dir = nullptr;
+
+    ~FILE_NATIVE()
+    {
+        if(file != nullptr) { fclose(file); }
+        if(dir != nullptr) { closedir(dir); }
+    }
+};
+
+/**
+ * @brief Host path of a card path
+ * 
+ */
+static std::string sd_path(const char* path)
+{
+    return native_path("sd/") + (path[0] == '/' ? path + 1 : path);
+}
+
+File::operator bool() const
+{
+    return impl && (impl->file != nullptr || impl->dir != nullptr);
+}
+
+size_t File::write(const uint8_t* data, size_t len)
+{
+    if(!*this || impl->file == nullptr) { return 0; }
+    return fwrite(data, 1, len, impl->file);
+}
+
+int File::read()
+{
+    uint8_t value;
+    return read(&value, 1) == 1 ? value : -1;
+}
+
+int File::read(uint8_t* data, size_t len)
+{
+    if(!*this || impl->file == nullptr) { return -1; }
+    return fread(data, 1, len, impl->file);
+}
+
+int File::available()
+{
+    if(!*this || impl->file == nullptr) { return 0; }
+    return size() - position();
+}
+
+bool File::seek(uint32_t pos)
+{
+    if(!*this || impl->file == nullptr) { return false; }
+    return fseek(impl->file, pos, SEEK_SET) == 0;
+}
+
+size_t File::position()
+{
+    if(!*this || impl->file == nullptr) { return 0; }
+    return ftell(impl->file);
+}
+
+size_t File::size()
+{
+    if(!*this || impl->file == nullptr) { return 0; }
+    fflush(impl->file);
+    struct stat info;
+    return fstat(fileno(impl->file), &info) == 0 ? info.st_size : 0;
+}
+
+void File::flush()
+{
+    if(*this && impl->file != nullptr) { fflush(impl->file); }
+}
+
+void File::close()
+{
+    impl.reset();
+}
+
+const char* File::name() const
+{
+    return impl ? impl->name.c_str() : "";
+}
+
+bool File::isDirectory() const
+{
+    return impl && impl->dir != nullptr;
+}
+
+File File::openNextFile(const char* mode)
+{
+    if(!isDirectory()) { return File(); }
+    struct dirent* entry;
+    while((entry = readdir(impl->dir)) != nullptr)
+    {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) { continue; }
+        std::string path = impl->path + (impl->path == "/" ? "" : "/") + entry->d_name;
+        return SD.open(path.c_str(), mode);
+    }
+    return File();
+}
+
+bool SDFS::begin()
+{
+    std::string root = native_path("sd/");
+    return ::mkdir(root.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+File SDFS::open(const char* path, const char* mode, bool create)
+{
+    std::shared_ptr<FILE_NATIVE> impl = std::make_shared<FILE_NATIVE>();
+    impl->path = path;
+    const char* base = strrchr(path, '/');
+    impl->name = base != nullptr ? base + 1 : path;
+    std::string host = sd_path(path);
+
+    struct stat info;
+    if(stat(host.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+    {
+        impl->dir = opendir(host.c_str());
+        return File(impl);
+    }
+    /** The ESP32 VFS opens "w" files for reading too, "r+" stays as is */
+    const char* host_mode = mode;
+    if(strcmp(mode, FILE_WRITE) == 0) { host_mode = "w+"; }
+    else if(strcmp(mode, FILE_APPEND) == 0) { host_mode = "a+"; }
+    impl->file = fopen(host.c_str(), host_mode);
+    return File(impl);
+}
+
+bool SDFS::exists(const char* path)
+{
+    return access(sd_path(path).c_str(), F_OK) == 0;
+}
+
+bool SDFS::remove(const char* path)
+{
+    return unlink(sd_path(path).c_str()) == 0;
+}
+
+bool SDFS::mkdir(const char* path)
+{
+    return ::mkdir(sd_path(path).c_str(), 0755) == 0;
+}
+
+bool SDFS::rmdir(const char* path)
+{
+    return ::rmdir(sd_path(path).c_str()) == 0;
+}
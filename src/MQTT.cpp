@@ -18,6 +18,12 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <modbus.h>
+#include <logger.h>
+#include <encoder.h>
+#include <metrics.h>
+#include <stall.h>
 
 /** SSL/TLS WiFi client */
 WiFiClientSecure secure_client;
@@ -25,18 +31,96 @@ WiFiClientSecure secure_client;
 PubSubClient mqtt_client(secure_client);
 /** Use CSV or individual readings */
 bool CSV = true;
-/** Give up on trying to connect */
-bool give_up = false;
-/** Retry time for WiFi/MQTT */
-uint64_t connect_time;
+/** Encoding of single topic payloads, payload_format_t */
+uint8_t payload_format = PAYLOAD_CSV;
+/** SD log, written by the network task */
+extern LOGGER logger_lib;
+/** Longest a WiFi join may take before it is retried, ms */
+#define WIFI_JOIN_TIME 15000
+/** Longest one broker connect may block loop(), s */
+#define MQTT_CONNECT_TIME 10
+/** First retry delay, ms */
+#define NET_BACKOFF_MIN 1000
+/** Longest retry delay, ms */
+#define NET_BACKOFF_MAX 300000
+/** WiFi/MQTT connection states */
+enum net_state_t
+{
+    NET_WIFI_START,
+    NET_WIFI_WAIT,
+    NET_MQTT_START,
+    NET_ONLINE,
+    NET_BACKOFF
+};
+/** Connection state */
+net_state_t net_state = NET_WIFI_START;
+/** State to go to once the backoff is over */
+net_state_t net_next;
+/** Time the state was entered, ms */
+uint32_t net_since;
+/** Current backoff and the jittered wait drawn from it, ms */
+uint32_t net_backoff;
+uint32_t net_wait;
+/** Readings waiting for the broker */
+OUTBOX outbox;
+/** Config downlinks waiting for the RS485 task */
+SPSC_RING<CONFIG_MSG, CONFIG_RING_SIZE> config_ring;
+/** PubSubClient packet buffer, caps one publish */
+#define MQTT_BUFFER_SIZE 2048
+/** Fixed header and topic length bytes of a publish */
+#define MQTT_PUBLISH_OVERHEAD 7
+/** Batch window value that follows the poll period */
+#define MQTT_BATCH_CYCLE 0xFFFFFFFF
+/** Batch window, ms, 0 publishes each reading on its own */
+uint32_t batch_time = 0;
+/** Readings gathered for one publish, epoch,addr,msg,values per line */
+char batch_data[MQTT_BUFFER_SIZE];
+size_t batch_len = 0;
+uint16_t batch_count = 0;
+/** First reading of the batch, ms */
+uint32_t batch_start;
+/** Poll period a cycle batch follows, ms, delay_time is 64 bit and owned by the RS485 task */
+std::atomic<uint32_t> batch_cycle{0};
+/** Set by a restart command, the network task restarts between SD writes */
+std::atomic<bool> restart_pending{false};
+/** USER/ZONE/ built once, every topic starts with it */
+char topic_base[96];
+size_t topic_base_len;
+/** MQTT_USER/MQTT_ID/stats */
+char stats_topic[96];
+/** MQTT_USER/MQTT_ID/stall */
+char stall_topic[96];
+/** Metrics publish period, s, 0 for none */
+uint32_t stats_time = 300;
+/** Zero counters and histograms each publish */
+bool stats_reset = false;
+/** Backlog replay run start, ms */
+uint32_t replay_start;
+/** Backlog readings sent this run */
+uint32_t replay_sent;
+/** The last failed publish is dropped rather than queued, it did not fit or part of it went out */
+bool publish_drop = false;
 
 /** Forward declaration */
-void wifi_connect();
-String parse_inc(String data);
-void mqtt_connect();
+void net_step();
+void net_retry(net_state_t next);
 void mqtt_downlink(char* topic, byte* message, unsigned int length);
 void MQTT_LOG(String chan, String data);
+void MQTT_LOG(const char* chan, const char* data);
 void parse_config(String data);
+bool config_net(uint16_t cmd);
+size_t mqtt_topic(char* buf, size_t size, int16_t addr, const char* suffix);
+bool encode_payload(const READING &reading, bool stamp, ENC_WRITER &out);
+bool publish_reading(const READING &reading);
+bool batch_add(const READING &reading);
+bool batch_flush();
+bool publish_backlog(const READING &reading);
+void outbox_replay();
+void outbox_report(uint32_t now);
+void metrics_report();
+void stall_report(bool dump);
+uint16_t parse_frame(std::vector<std::string> &seglist, uint8_t* frame);
+int16_t parse_index(std::vector<std::string> &seglist, size_t fields);
 
 /**
  * @brief Connect to WiFi and setup MQTT
@@ -44,12 +128,21 @@ void parse_config(String data);
  */
 void MQTT::mqtt_setup()
 {
-    wifi_connect();
+    WiFi.setHostname("RS485_data_logger");
+    secure_client.setCACert(server_root_ca);
+    secure_client.setHandshakeTimeout(MQTT_CONNECT_TIME);
+    secure_client.setTimeout(MQTT_CONNECT_TIME);
     mqtt_client.setServer(MQTT_SERVER, MQTT_PORT);
     mqtt_client.setKeepAlive(KEEP_ALIVE);
-    mqtt_client.setSocketTimeout(KEEP_ALIVE);
+    mqtt_client.setSocketTimeout(MQTT_CONNECT_TIME);
     mqtt_client.setCallback(mqtt_downlink);
-    connect_time = 3600000000;
+    mqtt_client.setBufferSize(MQTT_BUFFER_SIZE);
+    topic_base_len = snprintf(topic_base, sizeof(topic_base), "%s/%s/", MQTT_USER, ZONE_NAME.c_str());
+    if(topic_base_len >= sizeof(topic_base)) { topic_base_len = sizeof(topic_base) - 1; }
+    snprintf(stats_topic, sizeof(stats_topic), "%s/%s/stats", MQTT_USER, MQTT_ID);
+    snprintf(stall_topic, sizeof(stall_topic), "%s/%s/stall", MQTT_USER, MQTT_ID);
+    batch_cycle.store(delay_time / 1000, std::memory_order_relaxed);
+    net_step();
 }
 
 /**
@@ -58,154 +151,438 @@ void MQTT::mqtt_setup()
  */
 void MQTT::mqtt_loop()
 {
-    /** Always check MQTT connection */
-    if(!give_up)
+    /** Shutdown flushes the SD log, on this task it can not land mid write */
+    if(restart_pending.load(std::memory_order_acquire))
+    {
+        MQTT_LOG("MQTT", "Restarting");
+        ESP.restart();
+    }
+    /** One connection step per pass, RS485 keeps its cadence while offline */
+    {
+        STALL_PROBE probe(STALL_NET_CONNECT);
+        net_step();
+    }
+    if(net_state == NET_ONLINE)
     {
-        if(!mqtt_client.connected()) { mqtt_connect(); }
-        mqtt_client.loop();
-    } else {
-        static uint32_t last_time;
-        if ((micros() - last_time) >= connect_time)
         {
-            last_time += connect_time;
-            wifi_connect();
+            STALL_PROBE probe(STALL_MQTT_LOOP);
+            mqtt_client.loop();
+        }
+        if(mqtt_client.connected())
+        {
+            STALL_PROBE probe(STALL_MQTT_REPLAY);
+            uint32_t window = batch_time == MQTT_BATCH_CYCLE ? batch_cycle.load(std::memory_order_relaxed) : batch_time;
+            if(batch_len > 0 && (millis() - batch_start) >= window) { batch_flush(); }
+            outbox_replay();
+        }
+        if(mqtt_client.connected())
+        {
+            STALL_PROBE probe(STALL_MQTT_REPORT);
+            if(stalls.mqtt_pending) { stall_report(true); }
+            static uint32_t last_stats;
+            if(stats_time > 0 && (millis() - last_stats) >= stats_time * 1000)
+            {
+                last_stats = millis();
+                metrics_report();
+                stall_report(false);
+            }
         }
     }
 }
 
 /**
- * @brief Public CSV to MQTT
+ * @brief Apply bus config downlinks
+ * Called from the RS485 task, the only one that touches send_que
  * 
- * @param data 
  */
-void MQTT::mqtt_publish(String addr, String data)
+void MQTT::mqtt_config()
 {
-    if(mqtt_client.connected()) 
+    CONFIG_MSG* msg;
+    while((msg = config_ring.front()) != nullptr)
     {
-        String mqtt_data = parse_inc(data);
-        String mqtt_topic = String(MQTT_USER) + "/" + ZONE_NAME + "/" + addr;
-        if(CSV)
-        {
-            if(mqtt_client.publish(mqtt_topic.c_str(), mqtt_data.c_str()))
-            {
-                MQTT_LOG("MQTT", "Publish CSV");
-                MQTT_LOG("MQTT", mqtt_topic);
-                MQTT_LOG("MQTT", mqtt_data);
-            }
-        } else {
-            std::stringstream ss(data.c_str());
-            std::string segment;
-            char value = 'a';
-            while(std::getline(ss, segment, '+'))
-            {
-                mqtt_topic = String(MQTT_USER) + "/" + ZONE_NAME + "/" + addr + "/" + String(value++);
-                if(mqtt_client.publish(mqtt_topic.c_str(), segment.c_str()))
-                {
-                    MQTT_LOG("MQTT", "Publish SEGMENT");
-                    MQTT_LOG("MQTT", mqtt_topic);
-                    MQTT_LOG("MQTT", String(segment.c_str()));
-                } 
-            }
-        }
+        parse_config(String(msg->data));
+        config_ring.release();
     }
 }
 
 /**
- * @brief Parse incoming string to csv
+ * @brief Publish a reading to MQTT
+ * Queued for replay if the broker can not take it now
  * 
- * @param data 
+ * @param reading 
  */
-String parse_inc(String data)
+void MQTT::mqtt_publish(const READING &reading)
 {
-    String mqtt_data;
-    std::stringstream ss(data.c_str());
-    std::string segment;
-    std::vector<std::string> seglist;
-    while(std::getline(ss, segment, '+'))
+    if(batch_time > 0 && batch_add(reading)) { return; }
+    if(!mqtt_client.connected())
     {
-        seglist.push_back(segment);
+        outbox.push(reading);
+        return;
     }
+    uint32_t start = micros();
+    bool sent = publish_reading(reading);
+    metrics.record(M_PUB_US, micros() - start);
+    metrics.count(sent ? M_PUB_OK : M_PUB_FAIL);
+    if(!sent && !publish_drop) { outbox.push(reading); }
+}
 
-    uint16_t size = seglist.size();
-    for(int x = 0; x < size; x++)
+/**
+ * @brief Build a topic from the precomputed USER/ZONE/ base
+ * 
+ * @param buf 
+ * @param size 
+ * @param addr Slave address, -1 for none
+ * @param suffix Appended as is, may be empty
+ * @return size_t Topic length
+ */
+size_t mqtt_topic(char* buf, size_t size, int16_t addr, const char* suffix)
+{
+    size_t len = topic_base_len;
+    memcpy(buf, topic_base, len);
+    if(addr >= 0) { len += format_int(buf + len, addr); }
+    size_t suffix_len = strlen(suffix);
+    if(len + suffix_len >= size) { suffix_len = size - len - 1; }
+    memcpy(buf + len, suffix, suffix_len);
+    len += suffix_len;
+    buf[len] = 0;
+    return len;
+}
+
+/**
+ * @brief Encode a reading in the payload format
+ * 
+ * @param reading 
+ * @param stamp Add seq and epoch
+ * @param out 
+ * @return false if it did not fit, nothing is published
+ */
+bool encode_payload(const READING &reading, bool stamp, ENC_WRITER &out)
+{
+    encoders[payload_format](reading, stamp, out);
+    publish_drop = out.overflow();
+    if(publish_drop) { MQTT_LOG("MQTT", "Payload overflow, reading dropped"); }
+    return !publish_drop;
+}
+
+/**
+ * @brief Publish a live reading
+ * CSV on the address topic, or one value per sub topic up to the first that fails
+ * 
+ * @param reading 
+ * @return false if the client did not take it or it did not fit, publish_drop if it must not be queued
+ */
+bool publish_reading(const READING &reading)
+{
+    static uint8_t mqtt_data[ENC_MAX_SIZE];
+    char mqtt_topic_buf[128];
+    bool sent = true;
+    publish_drop = false;
+    size_t topic_len = mqtt_topic(mqtt_topic_buf, sizeof(mqtt_topic_buf) - 3, reading.addr, "");
+    if(CSV)
     {
-        if (x == size-1) {
-            mqtt_data += String(seglist[x].c_str());
-        } else {
-            mqtt_data += String(seglist[x].c_str()) + ",";
+        ENC_WRITER out(mqtt_data, sizeof(mqtt_data));
+        if(!encode_payload(reading, false, out)) { return false; }
+        sent = mqtt_client.publish(mqtt_topic_buf, mqtt_data, out.length());
+        if(sent)
+        {
+            char stats[48];
+            snprintf(stats, sizeof(stats), "Publish format %u, %uB", (unsigned)payload_format, (unsigned)out.length());
+            MQTT_LOG("MQTT", stats);
+            MQTT_LOG("MQTT", mqtt_topic_buf);
+        }
+    } else {
+        char value = 'a';
+        char text[16];
+        for(uint16_t x = 0; x < reading.count; x++)
+        {
+            mqtt_topic_buf[topic_len] = '/';
+            mqtt_topic_buf[topic_len + 1] = value++;
+            mqtt_topic_buf[topic_len + 2] = 0;
+            text[format_float(text, reading.values[x])] = 0;
+            if(!mqtt_client.publish(mqtt_topic_buf, text))
+            {
+                /** Queueing the reading would send the values already out again */
+                publish_drop = x > 0;
+                if(publish_drop) { MQTT_LOG("MQTT", "Publish SEGMENT cut short, rest dropped"); }
+                return false;
+            }
+            MQTT_LOG("MQTT", "Publish SEGMENT");
+            MQTT_LOG("MQTT", mqtt_topic_buf);
+            MQTT_LOG("MQTT", text);
         }
     }
+    return sent;
+}
 
-    return mqtt_data;
+/**
+ * @brief Add a reading to the batch
+ * A full batch is published first, while offline it is held
+ * 
+ * @param reading 
+ * @return false if the reading has to go out on its own
+ */
+bool batch_add(const READING &reading)
+{
+    static char line[READING_TEXT_SIZE + 32];
+    size_t len = 0;
+    len += format_int(line + len, reading.epoch);
+    line[len++] = ',';
+    len += format_int(line + len, reading.addr);
+    line[len++] = ',';
+    len += format_int(line + len, reading.msg + 1);
+    line[len++] = ',';
+    len += reading_format(reading, ",", false, line + len, sizeof(line) - len - 1);
+    line[len++] = '\n';
+
+    size_t cap = MQTT_BUFFER_SIZE - MQTT_PUBLISH_OVERHEAD - topic_base_len - 5;
+    if(len > cap) { return false; }
+    if(batch_len + len > cap && !batch_flush()) { return false; }
+    if(batch_len == 0) { batch_start = millis(); }
+    memcpy(batch_data + batch_len, line, len);
+    batch_len += len;
+    batch_count++;
+    return true;
 }
 
 /**
- * @brief Connect to Wifi
- * Use cert and secure client for SSL/TLS
+ * @brief Publish the batch on USER/ZONE/batch
  * 
+ * @return false if it could not be sent, it is kept
  */
-void wifi_connect()
+bool batch_flush()
 {
-    uint8_t wifi_retry = 0;
-    delay(10);
+    char mqtt_topic_buf[128];
+    mqtt_topic(mqtt_topic_buf, sizeof(mqtt_topic_buf), -1, "batch");
+    if(!mqtt_client.connected() || !mqtt_client.publish(mqtt_topic_buf, (const uint8_t*)batch_data, batch_len)) { return false; }
+    char stats[48];
+    snprintf(stats, sizeof(stats), "Publish BATCH %u readings %uB", (unsigned)batch_count, (unsigned)batch_len);
+    MQTT_LOG("MQTT", stats);
+    batch_len = 0;
+    batch_count = 0;
+    return true;
+}
 
-    MQTT_LOG("WiFi", "Connecting to " + String(SSID));
+/**
+ * @brief Publish a queued reading
+ * On the address backlog topic, seq,epoch,values for CSV
+ * 
+ * @param reading 
+ * @return false if the client did not take it or it did not fit
+ */
+bool publish_backlog(const READING &reading)
+{
+    static uint8_t mqtt_data[ENC_MAX_SIZE];
+    char mqtt_topic_buf[128];
+    mqtt_topic(mqtt_topic_buf, sizeof(mqtt_topic_buf), reading.addr, "/backlog");
+    ENC_WRITER out(mqtt_data, sizeof(mqtt_data));
+    if(!encode_payload(reading, true, out)) { return false; }
+    return mqtt_client.publish(mqtt_topic_buf, mqtt_data, out.length());
+}
 
-    WiFi.setHostname("RS485_data_logger");
-    WiFi.begin(SSID, PASSWORD);
+/**
+ * @brief Send a paced batch of queued readings
+ * Live readings go out between batches so they are never held up
+ * 
+ */
+void outbox_replay()
+{
+    static uint32_t last_batch;
+    static uint32_t last_report;
+    static READING replay;
+    if(outbox.depth() == 0) { return; }
+    uint32_t now = millis();
+    if((now - last_batch) < OUTBOX_BATCH_TIME) { return; }
+    last_batch = now;
+    if(replay_sent == 0) { replay_start = now; }
 
-    while(WiFi.status() != WL_CONNECTED)
+    for(uint8_t x = 0; x < OUTBOX_BATCH && outbox.peek(replay); x++)
     {
-        wifi_retry++;
-        if(wifi_retry == 10) 
-        { 
-            Serial.println(" Failed to connect to WiFi");
-            give_up = true;
-            break; 
-        }
-        MQTT_LOG("WiFi", "Retrying");
-        delay(500);
+        bool sent = publish_backlog(replay);
+        if(!sent && !publish_drop) { break; }
+        /** A reading that does not fit never will, it is counted and dropped */
+        if(sent) { replay_sent++; } else { metrics.count(M_PUB_FAIL); }
+        outbox.pop();
+    }
+
+    if(outbox.depth() == 0 || (now - last_report) >= OUTBOX_REPORT_TIME)
+    {
+        last_report = now;
+        outbox_report(now);
+    }
+    if(outbox.depth() == 0) { replay_sent = 0; }
+}
+
+/**
+ * @brief Publish queue depth and replay throughput
+ * depth,spooled,sent,dropped,readings/min on the outbox topic
+ * 
+ * @param now ms
+ */
+void outbox_report(uint32_t now)
+{
+    const OUTBOX_STATS &stats = outbox.stats();
+    uint32_t took = now - replay_start;
+    uint32_t rate = replay_sent * 60000ULL / (took ? took : 1);
+    char mqtt_topic_buf[128];
+    char mqtt_data[64];
+    mqtt_topic(mqtt_topic_buf, sizeof(mqtt_topic_buf), -1, "outbox");
+    snprintf(mqtt_data, sizeof(mqtt_data), "%u,%u,%u,%u,%u", (unsigned)outbox.depth(), (unsigned)outbox.spool_depth(),
+        (unsigned)stats.sent, (unsigned)stats.dropped, (unsigned)rate);
+    if(mqtt_client.publish(mqtt_topic_buf, mqtt_data))
+    {
+        MQTT_LOG("MQTT", "Publish OUTBOX");
+        MQTT_LOG("MQTT", mqtt_data);
     }
+}
 
-    if(WiFi.status() == WL_CONNECTED)
+/**
+ * @brief Publish the metrics registry as one line on MQTT_USER/MQTT_ID/stats
+ * Heap and SD log gauges are sampled here, see METRICS::format() for the layout
+ * The SD log is written on this task too, so its stats are read whole
+ * 
+ */
+void metrics_report()
+{
+    static char mqtt_data[MQTT_BUFFER_SIZE / 2];
+    metrics.gauge(M_HEAP_FREE, ESP.getFreeHeap());
+    metrics.gauge(M_HEAP_BLOCK, ESP.getMaxAllocHeap());
+    const LOGGER_STATS &sd = logger_lib.logger_stats();
+    metrics.gauge(M_SD_KB, sd.bytes / 1024);
+    metrics.gauge(M_SD_RAW_KB, sd.raw_bytes / 1024);
+    metrics.gauge(M_SD_ROLLED, sd.rolled);
+    metrics.gauge(M_SD_PRUNED, sd.pruned);
+    size_t len = metrics.format(mqtt_data, sizeof(mqtt_data), stats_reset);
+    if(mqtt_client.publish(stats_topic, (const uint8_t*)mqtt_data, len))
     {
-        MQTT_LOG("WiFi", "Connected");
-        MQTT_LOG("WiFi", "IP address: " + String(WiFi.localIP().toString()));
-        secure_client.setTimeout(KEEP_ALIVE);
-        secure_client.setCACert(server_root_ca);
-        give_up = false;
+        MQTT_LOG("MQTT", "Publish STATS");
+        MQTT_LOG("MQTT", mqtt_data);
     }
 }
 
 /**
- * @brief Connect to MQTT server
+ * @brief Publish stalls on MQTT_USER/MQTT_ID/stall
  * 
+ * @param dump The watchdog dump from before the last reset, else the worst stalls so far
  */
-void mqtt_connect()
+void stall_report(bool dump)
 {
-    uint8_t mqtt_retry = 0;
-    while(!mqtt_client.connected() && WiFi.status() == WL_CONNECTED)
+    char mqtt_data[512];
+    size_t len = dump ? stalls.format_dump(mqtt_data, sizeof(mqtt_data)) : stalls.format_worst(mqtt_data, sizeof(mqtt_data), stats_reset);
+    if(mqtt_client.publish(stall_topic, (const uint8_t*)mqtt_data, len))
     {
-        MQTT_LOG("MQTT", "Connecting to broker");
-        if(mqtt_client.connect(MQTT_ID, MQTT_USER, MQTT_PASS))
+        if(dump) { stalls.mqtt_pending = false; }
+        MQTT_LOG("MQTT", "Publish STALL");
+        MQTT_LOG("MQTT", mqtt_data);
+    }
+}
+
+/**
+ * @brief Publish slave health changes
+ * 
+ * @param addr Slave address
+ * @param state state,timeouts,crc_errors
+ */
+void MQTT::mqtt_status(String addr, String state)
+{
+    if(mqtt_client.connected()) 
+    {
+        char mqtt_topic_buf[128];
+        mqtt_topic(mqtt_topic_buf, sizeof(mqtt_topic_buf), addr.toInt(), "/status");
+        if(mqtt_client.publish(mqtt_topic_buf, state.c_str()))
         {
-            MQTT_LOG("MQTT", "Connected to broker");
-            mqtt_client.subscribe(MQTT_CONFIG.c_str());
-            give_up = false;
-        } else {
-            MQTT_LOG("MQTT", "Error code: " + String(mqtt_client.state()));
-            mqtt_retry++;
-            if(mqtt_retry == 10)
+            MQTT_LOG("MQTT", "Publish STATUS");
+            MQTT_LOG("MQTT", mqtt_topic_buf);
+            MQTT_LOG("MQTT", state);
+        }
+    }
+}
+
+/**
+ * @brief Advance the WiFi/MQTT connection one step
+ * Never waits, a broker connect is the only call that
+ * blocks and only for up to MQTT_CONNECT_TIME
+ * 
+ */
+void net_step()
+{
+    uint32_t now = millis();
+    switch(net_state)
+    {
+        case NET_WIFI_START:
+            MQTT_LOG("WiFi", "Connecting to " + String(SSID));
+            WiFi.begin(SSID, PASSWORD);
+            net_state = NET_WIFI_WAIT;
+            net_since = now;
+        break;
+        case NET_WIFI_WAIT:
+            if(WiFi.status() == WL_CONNECTED)
             {
-                MQTT_LOG("MQTT", "Failed to connect to MQTT");
-                give_up = true;
-                break; 
+                MQTT_LOG("WiFi", "Connected");
+                metrics.count(M_WIFI_CONNECT);
+                MQTT_LOG("WiFi", "IP address: " + String(WiFi.localIP().toString()));
+                net_state = NET_MQTT_START;
+            } else if((now - net_since) >= WIFI_JOIN_TIME) {
+                MQTT_LOG("WiFi", "Failed to connect to WiFi");
+                WiFi.disconnect();
+                net_retry(NET_WIFI_START);
             }
-            delay(5000);
-        }
+        break;
+        case NET_MQTT_START:
+            if(WiFi.status() != WL_CONNECTED)
+            {
+                net_state = NET_WIFI_WAIT;
+                net_since = now;
+                break;
+            }
+            MQTT_LOG("MQTT", "Connecting to broker");
+            if(mqtt_client.connect(MQTT_ID, MQTT_USER, MQTT_PASS))
+            {
+                MQTT_LOG("MQTT", "Connected to broker");
+                metrics.count(M_MQTT_CONNECT);
+                mqtt_client.subscribe(MQTT_CONFIG.c_str());
+                net_state = NET_ONLINE;
+                net_backoff = 0;
+            } else {
+                MQTT_LOG("MQTT", "Error code: " + String(mqtt_client.state()));
+                net_retry(NET_MQTT_START);
+            }
+        break;
+        case NET_ONLINE:
+            if(!mqtt_client.connected())
+            {
+                MQTT_LOG("MQTT", "Lost broker");
+                /** Jittered even the first time, so a broker restart is not hit by the whole fleet at once */
+                net_retry(NET_MQTT_START);
+            }
+        break;
+        case NET_BACKOFF:
+            if((now - net_since) >= net_wait)
+            {
+                net_state = net_next;
+                net_since = now;
+            }
+        break;
     }
 }
 
+/**
+ * @brief Wait before trying again
+ * The backoff doubles per failure and the wait is a random
+ * point in its upper half, so retries spread across the fleet
+ * 
+ * @param next State to retry from
+ */
+void net_retry(net_state_t next)
+{
+    net_backoff = net_backoff ? net_backoff * 2 : NET_BACKOFF_MIN;
+    if(net_backoff > NET_BACKOFF_MAX) { net_backoff = NET_BACKOFF_MAX; }
+    net_wait = net_backoff / 2 + random(net_backoff / 2 + 1);
+    net_next = next;
+    net_state = NET_BACKOFF;
+    net_since = millis();
+    MQTT_LOG("MQTT", "Retry in " + String(net_wait) + "ms");
+}
+
 /**
  * @brief MQTT Downlink handler
  * 
@@ -217,21 +594,53 @@ void mqtt_connect()
 void mqtt_downlink(char* topic, byte* message, unsigned int length)
 {
     String topic_string = String(topic);
-    String mqtt_data;
     if(topic_string == MQTT_CONFIG)
     {
-        for(int x = 0; x < length; x++)
+        char data[CONFIG_MSG_SIZE];
+        if(length > CONFIG_MSG_SIZE - 1) { length = CONFIG_MSG_SIZE - 1; }
+        memcpy(data, message, length);
+        data[length] = 0;
+        /** Settings this task reads, and restarts, are applied here */
+        if(config_net(atoi(data)))
+        {
+            parse_config(String(data));
+            return;
+        }
+        /** Config that touches the bus, the RS485 task applies it */
+        CONFIG_MSG* msg = config_ring.claim();
+        if(msg == nullptr)
         {
-            mqtt_data += (char)message[x];
+            MQTT_LOG("MQTT", "Config queue full, dropped");
+            return;
         }
-        parse_config(mqtt_data);
+        memcpy(msg->data, data, length + 1);
+        config_ring.commit();
     } else {
         MQTT_LOG("MQTT", "MQTT downlink recieved");
     }
 }
 
+/**
+ * @brief Config commands the network task applies
+ * The SD and publish settings it reads while running, the rest
+ * keep their order through the RS485 task, restarts included
+ * 
+ * @param cmd Command number
+ * @return false if the RS485 task applies it
+ */
+bool config_net(uint16_t cmd)
+{
+    switch(cmd)
+    {
+        case 0: case 10: case 12: case 13: case 14: case 17:
+            return true;
+    }
+    return false;
+}
+
 /**
  * @brief Parse incoming MQTT data for config changes
+ * Runs on the task config_net() picks for the command
  * 
  * @param data 
  */
@@ -246,7 +655,8 @@ void parse_config(String data)
     }
 
     uint16_t cmd_int = stoi(seglist[0]);
-    std::array<uint8_t, 8> msg_array;
+    uint8_t frame[MODBUS_MAX_FRAME];
+    uint16_t frame_len;
     String msg_name;
     switch(cmd_int)
     {
@@ -265,84 +675,236 @@ void parse_config(String data)
         /** CMD 1: Sleep period */
         case 1:
             delay_time = stoi(seglist[1])*1000000;
+            batch_cycle.store(delay_time / 1000, std::memory_order_relaxed);
             flash_64u("period", delay_time, false);
+            rs485_plan();
             MQTT_LOG("MQTT", "Delay set to " + String(seglist[1].c_str()));
         break;
         /** CMD 2: Add repeated RS485 message */
         case 2:
-            uint8_t temp_array[8];
-            for(int x = 0; x < 8; x++)
-            {
-                uint8_t num = std::stoul(seglist[x+1], nullptr, 16);
-                msg_array[x] = num;
-                temp_array[x] = num;
-            }
-            send_que.push_back(msg_array);
-            read_num++;
-            flash_32u("rnum", read_num, false);
+            frame_len = parse_frame(seglist, frame);
+            if(frame_len == 0) { break; }
+            send_que.add(frame, frame_len, 0, 0);
+            rs485_plan();
+            flash_msgs();
             msg_name = "msg" + String(read_num);
-            flash_bytes(msg_name.c_str(), temp_array, false);
             MQTT_LOG("MQTT", "Added repeated RS485 message " + msg_name);
         break;
         /** CMD 3: Send a one time RS485 message, no MQTT/logger */
         case 3:
-            uint8_t ottemp_array[8];
-            for(int x = 0; x < 8; x++)
-            {
-                uint8_t num = std::stoul(seglist[x+1], nullptr, 16);
-                ottemp_array[x] = num;
-            }
-            send_onetime(ottemp_array);
+            frame_len = parse_frame(seglist, frame);
+            if(frame_len == 0) { break; }
+            send_onetime(frame, frame_len);
             MQTT_LOG("MQTT", "Sent one time RS485 message");
         break;
         /** CMD 4: Use SD card */
         case 4:
             if(seglist[1] == "true")
             {
-                use_sd = true;
+                flash_bool("sd", true, false);
                 MQTT_LOG("SD", "Set to true, restarting...");
             } else {
-                use_sd = false;
+                flash_bool("sd", false, false);
                 MQTT_LOG("SD", "Set to false, restarting...");
             }
-            flash_bool("sd", use_sd, false);
-            ESP.restart();
+            restart_pending.store(true, std::memory_order_release);
         break;
         /** CMD 5: Change GMT/DST offset */
         case 5:
             flash_32("gmt", stoi(seglist[1]), false);
             flash_32u("dst", stoi(seglist[2]), false);
             MQTT_LOG("MQTT", "Changed GMT/DST, restarting...");
-            ESP.restart();
+            restart_pending.store(true, std::memory_order_release);
         break;
         /** CMD 6: Change logger baud rate */
         case 6:
             flash_32u("baud", stoi(seglist[1]), false);
             MQTT_LOG("MQTT", "Changed logger baud rate, restarting...");
-            ESP.restart();
+            restart_pending.store(true, std::memory_order_release);
         break;
         /** CMD 7: Delete repeated message */
         case 7:
-            std::array<uint8_t, 8> del_array;
-            for(int x = 0; x < 8; x++)
-            {
-                uint8_t num = std::stoul(seglist[x+1], nullptr, 16);
-                del_array[x] = num;
-            }
-            auto it = std::find(send_que.begin(), send_que.end(), del_array);
-            if (it != send_que.end()) 
+        {
+            frame_len = parse_frame(seglist, frame);
+            if(frame_len == 0) { break; }
+            int16_t index = send_que.find(frame, frame_len);
+            if (index >= 0) 
             {
                 MQTT_LOG("MQTT", "Match found, deleting");
-                uint8_t index = std::distance(send_que.begin(), it);
-                send_que.erase(it);
-                delete_key("msg" + index);
-                read_num--;
-                flash_32u("rnum", read_num, false);
+                send_que.remove(index);
+                rs485_plan();
+                flash_msgs();
             } else {
                 MQTT_LOG("MQTT", "Could not find match");
             }
+        }
+        break;
+        /** CMD 8: Set poll interval (seconds) and priority of repeated message N */
+        case 8:
+        {
+            int16_t index = parse_index(seglist, 3);
+            if(index < 0) { break; }
+            send_que[index].interval = stoul(seglist[2]) * 1000;
+            if(seglist.size() > 3) { send_que[index].priority = stoi(seglist[3]); }
+            /** Message numbers stay, deadband and aggregate state is kept */
+            rs485_plan(false);
+            flash_msgs();
+            MQTT_LOG("MQTT", "Message " + String(index + 1) + " every " + String(seglist[2].c_str()) + "s");
+        }
+        break;
+        /** CMD 9: Set register decoding of repeated message N, type+order+scale+offset */
+        case 9:
+        {
+            int16_t index = parse_index(seglist, 6);
+            DECODE_DESC desc;
+            if(index < 0) { break; }
+            if(!decode_parse(seglist[2].c_str(), seglist[3].c_str(), stof(seglist[4]), stof(seglist[5]), desc))
+            {
+                MQTT_LOG("MQTT", "Unknown type/order " + String(seglist[2].c_str()) + "/" + String(seglist[3].c_str()));
+                break;
+            }
+            send_que[index].decode = desc;
+            flash_msgs();
+            MQTT_LOG("MQTT", "Message " + String(index + 1) + " decoded as " + String(seglist[2].c_str()));
+        }
+        break;
+        /** CMD 10: SD flush interval in seconds */
+        case 10:
+            sd_flush_time = stoul(seglist[1]) * 1000;
+            flash_32u("sdflush", sd_flush_time, false);
+            MQTT_LOG("SD", "Flush every " + String(seglist[1].c_str()) + "s");
+        break;
+        /** CMD 11: SD log format, text or bin */
+        case 11:
+            if(seglist[1] == "bin")
+            {
+                flash_8u("sdfmt", LOG_BINARY, false);
+                MQTT_LOG("SD", "Binary log, restarting...");
+            } else {
+                flash_8u("sdfmt", LOG_TEXT, false);
+                MQTT_LOG("SD", "Text log, restarting...");
+            }
+            restart_pending.store(true, std::memory_order_release);
         break;
+        /** CMD 12: SD segment size in KB and log budget in MB */
+        case 12:
+            sd_segment_kb = stoul(seglist[1]);
+            sd_budget_mb = stoul(seglist[2]);
+            flash_32u("segkb", sd_segment_kb, false);
+            flash_32u("budmb", sd_budget_mb, false);
+            MQTT_LOG("SD", "Segments of " + String(sd_segment_kb) + "KB, " + String(sd_budget_mb) + "MB total");
+        break;
+        /** CMD 13: Batch readings, off, cycle or a window in seconds */
+        case 13:
+            if(seglist[1] == "cycle")
+            {
+                batch_time = MQTT_BATCH_CYCLE;
+            } else if(seglist[1] == "off") {
+                batch_time = 0;
+            } else {
+                batch_time = stoul(seglist[1]) * 1000;
+            }
+            flash_32u("batch", batch_time, false);
+            MQTT_LOG("MQTT", "Batch set to " + String(seglist[1].c_str()));
+        break;
+        /** CMD 14: Payload format, csv, json or cbor */
+        case 14:
+            if(!encoder_parse(seglist[1].c_str(), payload_format))
+            {
+                MQTT_LOG("MQTT", "Unknown format " + String(seglist[1].c_str()));
+                break;
+            }
+            flash_8u("payload", payload_format, false);
+            MQTT_LOG("MQTT", "Payload format " + String(seglist[1].c_str()));
+        break;
+        /** CMD 15: Deadband, "15+N+absolute+percent+heartbeat_s" */
+        case 15:
+        {
+            int16_t index = parse_index(seglist, 5);
+            if(index < 0) { break; }
+            DEADBAND_DESC &deadband = send_que[index].deadband;
+            deadband.absolute = stof(seglist[2]);
+            deadband.percent = stof(seglist[3]) * 100;
+            deadband.heartbeat = stoul(seglist[4]);
+            flash_msgs();
+            MQTT_LOG("MQTT", "Message " + String(index + 1) + " deadband " + String(seglist[2].c_str()) + "/" + String(seglist[3].c_str()) + "%");
+        }
+        break;
+        /** CMD 16: Aggregate, "16+window_s+raw_to_sd" */
+        case 16:
+            agg_window = stoul(seglist[1]);
+            agg_raw = seglist.size() > 2 && seglist[2] == "true";
+            flash_32u("aggwin", agg_window, false);
+            flash_bool("aggraw", agg_raw, false);
+            rs485_plan();
+            MQTT_LOG("MQTT", "Aggregate every " + String(agg_window) + "s");
+        break;
+        /** CMD 17: Metrics, "17+period_s+reset_on_read" */
+        case 17:
+            stats_time = stoul(seglist[1]);
+            stats_reset = seglist.size() > 2 && seglist[2] == "true";
+            flash_32u("stats", stats_time, false);
+            flash_bool("statrst", stats_reset, false);
+            MQTT_LOG("MQTT", "Metrics every " + String(stats_time) + "s");
+        break;
+    }
+}
+
+/**
+ * @brief Repeated message N of a config command, checked before use
+ * 
+ * @param seglist 
+ * @param fields Fields the command needs, the command itself included
+ * @return int16_t send_que index, -1 if fields are missing or there is no message N
+ */
+int16_t parse_index(std::vector<std::string> &seglist, size_t fields)
+{
+    if(seglist.size() < fields)
+    {
+        MQTT_LOG("MQTT", "Missing config fields");
+        return -1;
     }
+    unsigned long index = strtoul(seglist[1].c_str(), nullptr, 10);
+    if(index < 1 || index > send_que.size())
+    {
+        MQTT_LOG("MQTT", "No repeated message " + String(seglist[1].c_str()));
+        return -1;
+    }
+    return index - 1;
+}
+
+/**
+ * @brief Parse hex bytes of a config command into an RS485 frame
+ * Any Modbus request is accepted, the CRC is appended
+ * unless the last two bytes are the CRC of a whole request
+ * 
+ * @param seglist Config command, bytes start at index 1
+ * @param frame Output frame, MODBUS_MAX_FRAME bytes
+ * @return uint16_t Frame length with CRC, 0 if unusable
+ */
+uint16_t parse_frame(std::vector<std::string> &seglist, uint8_t* frame)
+{
+    size_t len = seglist.size() - 1;
+    if(len < 2 || len > MODBUS_MAX_FRAME)
+    {
+        MQTT_LOG("MQTT", "RS485 message needs 2 to 256 bytes");
+        return 0;
+    }
+
+    for(size_t x = 0; x < len; x++)
+    {
+        frame[x] = std::stoul(seglist[x+1], nullptr, 16);
+    }
+
+    /** A body that happens to end in its own CRC is not cut short */
+    size_t body = len;
+    if(len > 2 && modbus_check_crc(frame, len) && modbus_request_len(frame, len - 2) == len - 2) { body = len - 2; }
+    if(modbus_request_len(frame, body) != body || body > MODBUS_MAX_FRAME - 2)
+    {
+        MQTT_LOG("MQTT", "Malformed RS485 message");
+        return 0;
+    }
+    return modbus_add_crc(frame, body);
 }
 
 /**
@@ -354,7 +916,25 @@ void parse_config(String data)
 void MQTT_LOG(String chan, String data)
 {
     #if MQTT_DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
     String disp = "["+chan+"] " + data;
     Serial.println(disp);
     #endif
 }
+
+/**
+ * @brief Debug output text without touching the heap
+ * 
+ * @param chan Output channel
+ * @param data Text to output
+ */
+void MQTT_LOG(const char* chan, const char* data)
+{
+    #if MQTT_DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
+    Serial.print("[");
+    Serial.print(chan);
+    Serial.print("] ");
+    Serial.println(data);
+    #endif
+}
@@ -14,6 +14,24 @@
 
 #include <map>
 #include <vector>
+#include <rs485_msg.h>
+#include <reading.h>
+#include <outbox.h>
+#include <spsc_ring.h>
+
+/** Longest config downlink */
+#define CONFIG_MSG_SIZE 256
+/** Config downlinks waiting, power of two */
+#define CONFIG_RING_SIZE 4
+
+/**
+ * @brief Config downlink handed to the RS485 task
+ * 
+ */
+struct CONFIG_MSG
+{
+    char data[CONFIG_MSG_SIZE];
+};
 
 /**
  * @brief MQTT Lib
@@ -24,23 +42,34 @@ class MQTT
     public:
     void mqtt_setup();
     void mqtt_loop();
-    void mqtt_publish(String addr, String data);
+    void mqtt_config();
+    void mqtt_publish(const READING &reading);
+    void mqtt_status(String addr, String state);
 };
 
 /** Overloads for config */
 extern uint64_t delay_time;
 extern bool CSV;
-extern bool give_up;
+extern uint32_t batch_time;
+extern uint8_t payload_format;
+extern uint32_t agg_window;
+extern bool agg_raw;
+extern uint32_t stats_time;
+extern bool stats_reset;
 extern bool use_sd;
-extern std::vector<std::array<uint8_t, 8>> send_que;
+extern MSG_QUE send_que;
+extern OUTBOX outbox;
 extern uint8_t read_num;
 void chng_addr(String addr_old, String addr_new);
 void flash_32(const char* key, int32_t value, bool restart);
 void flash_32u(const char* key, uint32_t value, bool restart);
 void flash_64u(const char* key, uint64_t value, bool restart);
+void flash_8u(const char* key, uint8_t value, bool restart);
 void flash_bool(const char* key, bool value, bool restart);
-void flash_bytes(const char* key, uint8_t value[8], bool restart);
-void send_onetime(uint8_t value[8]);
+void flash_bytes(const char* key, const uint8_t* value, size_t len, bool restart);
+void flash_msgs();
+void send_onetime(const uint8_t* value, uint16_t len);
+void rs485_plan(bool renumbered = true);
 void delete_key(String key);
 
 #endif
@@ -0,0 +1,117 @@
+/**
+ * @file aggregate.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-09
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <aggregate.h>
+#include <decode.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * @brief Drop every window, after send_que changes
+ * 
+ */
+void AGGREGATE::clear()
+{
+    memset(msgs, 0, sizeof(msgs));
+    used = 0;
+}
+
+/**
+ * @brief Fold a reading into its message's window
+ * 
+ * @param reading 
+ * @param now ms
+ * @param window Window length, ms
+ * @param summary Filled when AGG_SUMMARY is returned
+ * @return agg_result_t 
+ */
+agg_result_t AGGREGATE::add(const READING &reading, uint32_t now, uint32_t window, READING &summary)
+{
+    if(reading.msg >= AGG_MAX_MSGS || reading.count == 0) { return AGG_SKIP; }
+    AGG_MSG &msg = msgs[reading.msg];
+    if(msg.regs == 0)
+    {
+        uint8_t regs = reading.count < AGG_MAX_REGS ? reading.count : AGG_MAX_REGS;
+        if(used + regs > AGG_POOL) { return AGG_SKIP; }
+        msg.first = used;
+        msg.regs = regs;
+        msg.addr = reading.addr;
+        used += regs;
+        reset(msg, now);
+    }
+
+    agg_result_t result = AGG_HELD;
+    if(msg.samples > 0 && (now - msg.start) >= window)
+    {
+        summarize(msg, reading.msg, summary);
+        reset(msg, now);
+        result = AGG_SUMMARY;
+    }
+
+    msg.samples++;
+    uint8_t regs = reading.count < msg.regs ? reading.count : msg.regs;
+    for(uint8_t x = 0; x < regs; x++)
+    {
+        AGG_STAT &stat = stats[msg.first + x];
+        float value = reading.values[x];
+        if(value < stat.min) { stat.min = value; }
+        if(value > stat.max) { stat.max = value; }
+        double delta = value - stat.mean;
+        stat.mean += delta / msg.samples;
+        stat.m2 += delta * (value - stat.mean);
+    }
+    return result;
+}
+
+/**
+ * @brief Summary reading of a finished window
+ * f32 values, samples then min,max,mean,stddev per register
+ * 
+ */
+void AGGREGATE::summarize(const AGG_MSG &msg, uint8_t index, READING &summary)
+{
+    summary.addr = msg.addr;
+    summary.msg = index;
+    summary.type = REG_F32;
+    summary.scale = 1;
+    summary.offset = 0;
+    summary.values[0] = msg.samples;
+    uint16_t count = 1;
+    for(uint8_t x = 0; x < msg.regs; x++)
+    {
+        const AGG_STAT &stat = stats[msg.first + x];
+        summary.values[count++] = stat.min;
+        summary.values[count++] = stat.max;
+        summary.values[count++] = stat.mean;
+        summary.values[count++] = msg.samples > 1 ? sqrt(stat.m2 / (msg.samples - 1)) : 0;
+    }
+    summary.count = count;
+    /** Raw carries the float bits, as for any f32 register */
+    memcpy(summary.raw, summary.values, count * sizeof(float));
+}
+
+/**
+ * @brief Start a new window
+ * 
+ */
+void AGGREGATE::reset(AGG_MSG &msg, uint32_t now)
+{
+    msg.samples = 0;
+    msg.start = now;
+    for(uint8_t x = 0; x < msg.regs; x++)
+    {
+        AGG_STAT &stat = stats[msg.first + x];
+        stat.min = INFINITY;
+        stat.max = -INFINITY;
+        stat.mean = 0;
+        stat.m2 = 0;
+    }
+}
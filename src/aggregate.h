@@ -0,0 +1,85 @@
+/**
+ * @file aggregate.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-09
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __aggregate_H__
+#define __aggregate_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <reading.h>
+
+/** Messages that can be aggregated */
+#define AGG_MAX_MSGS 32
+/** Register stats shared by all messages */
+#define AGG_POOL 256
+/** Registers per summary, samples then min,max,mean,stddev each */
+#define AGG_MAX_REGS ((READING_MAX_VALUES - 1) / 4)
+
+/** What add() did with a reading */
+enum agg_result_t
+{
+    /** Not aggregated, send it on as is */
+    AGG_SKIP,
+    /** Folded into the window */
+    AGG_HELD,
+    /** Folded in, and the previous window's summary is ready */
+    AGG_SUMMARY
+};
+
+/**
+ * @brief Running stats of one register, Welford
+ * 
+ */
+struct AGG_STAT
+{
+    float min;
+    float max;
+    double mean;
+    /** Sum of squared distances from the mean */
+    double m2;
+};
+
+/**
+ * @brief Window of one message
+ * 
+ */
+struct AGG_MSG
+{
+    /** First stat in the pool, regs 0 until first seen */
+    uint16_t first;
+    uint8_t regs;
+    uint8_t addr;
+    uint32_t samples;
+    /** Window start, ms */
+    uint32_t start;
+};
+
+/**
+ * @brief Tumbling window min/max/mean/stddev per register
+ * Fixed memory, a window closes on the first reading past its end
+ * 
+ */
+class AGGREGATE
+{
+    public:
+    void clear();
+    agg_result_t add(const READING &reading, uint32_t now, uint32_t window, READING &summary);
+
+    private:
+    void summarize(const AGG_MSG &msg, uint8_t index, READING &summary);
+    void reset(AGG_MSG &msg, uint32_t now);
+
+    AGG_STAT stats[AGG_POOL];
+    AGG_MSG msgs[AGG_MAX_MSGS] = {};
+    uint16_t used = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file alloc_count.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <alloc_count.h>
+#include <stddef.h>
+
+#ifdef ALLOC_COUNT
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+/** Only allocations from this task count, WiFi/TCP tasks allocate all the time */
+static TaskHandle_t tracked_task;
+static uint32_t tracked_count;
+static uint32_t tracked_bytes;
+#define ALLOC_COUNTED() (xTaskGetCurrentTaskHandle() == tracked_task)
+#define ALLOC_COUNTER tracked_count
+#define ALLOC_BYTES tracked_bytes
+#else
+static thread_local uint32_t thread_count;
+static thread_local uint32_t thread_bytes;
+#define ALLOC_COUNTED() (true)
+#define ALLOC_COUNTER thread_count
+#define ALLOC_BYTES thread_bytes
+#endif
+
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t num, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+
+    void* __wrap_malloc(size_t size)
+    {
+        if(ALLOC_COUNTED()) { ALLOC_COUNTER++; ALLOC_BYTES += size; }
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t num, size_t size)
+    {
+        if(ALLOC_COUNTED()) { ALLOC_COUNTER++; ALLOC_BYTES += num * size; }
+        return __real_calloc(num, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        if(ALLOC_COUNTED()) { ALLOC_COUNTER++; ALLOC_BYTES += size; }
+        return __real_realloc(ptr, size);
+    }
+}
+
+/**
+ * @brief Count allocations made by the calling task
+ * 
+ */
+void alloc_track()
+{
+#ifdef ARDUINO
+    tracked_task = xTaskGetCurrentTaskHandle();
+#endif
+}
+
+/**
+ * @brief Allocations made so far by the tracked task
+ * 
+ * @return uint32_t 
+ */
+uint32_t alloc_count()
+{
+    return ALLOC_COUNTER;
+}
+
+/**
+ * @brief Bytes asked for by the tracked task so far, realloc counts its new size
+ * 
+ * @return uint32_t 
+ */
+uint32_t alloc_bytes()
+{
+    return ALLOC_BYTES;
+}
+
+#else
+
+void alloc_track() { }
+uint32_t alloc_count() { return 0; }
+uint32_t alloc_bytes() { return 0; }
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * @file alloc_count.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __alloc_count_H__
+#define __alloc_count_H__
+
+#include <stdint.h>
+
+/**
+ * Heap allocation counter
+ * Build with -DALLOC_COUNT -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,
+ * as env:wiscore_rak11200_alloc and env:native do, and every malloc/calloc/realloc made by the tracked task is counted,
+ * along with the bytes asked for, other builds always report 0
+ * 
+ */
+void alloc_track();
+uint32_t alloc_count();
+uint32_t alloc_bytes();
+
+#endif
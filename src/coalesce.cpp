@@ -0,0 +1,151 @@
+/**
+ * @file coalesce.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-22
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <coalesce.h>
+#include <modbus.h>
+#include <algorithm>
+
+/**
+ * @brief Decoded read request
+ * 
+ */
+struct read_req
+{
+    uint8_t entry;
+    uint8_t slave;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+    uint32_t interval;
+    uint8_t priority;
+};
+
+/**
+ * @brief Is this queued frame a plain FC03/FC04 read
+ * 
+ * @param frame 
+ * @param req Decoded request
+ * @return true 
+ */
+bool decode_read(const uint8_t* frame, uint16_t len, read_req &req)
+{
+    if(len != 8 || (frame[1] != FC_READ_HOLDING && frame[1] != FC_READ_INPUT_REGS)) { return false; }
+    if(!modbus_check_crc(frame, len)) { return false; }
+    req.slave = frame[0];
+    req.function = frame[1];
+    req.start = (frame[2] << 8) | frame[3];
+    req.count = (frame[4] << 8) | frame[5];
+    return req.count > 0 && req.count <= MAX_READ_REGS;
+}
+
+/**
+ * @brief Write the frame of a merged read
+ * 
+ * @param txn 
+ * @param frames Arena the frame is appended to
+ */
+void encode_read(RS485_TXN &txn, std::vector<uint8_t> &frames)
+{
+    uint8_t frame[8];
+    frame[0] = txn.slave;
+    frame[1] = txn.function;
+    frame[2] = txn.start >> 8;
+    frame[3] = txn.start & 0xFF;
+    frame[4] = txn.count >> 8;
+    frame[5] = txn.count & 0xFF;
+    txn.offset = frames.size();
+    txn.len = modbus_add_crc(frame, 6);
+    frames.insert(frames.end(), frame, frame + txn.len);
+}
+
+void coalesce_build(const MSG_QUE &que, std::vector<RS485_TXN> &plan, std::vector<RS485_MEMBER> &members, std::vector<uint8_t> &frames)
+{
+    plan.clear();
+    members.clear();
+    frames.clear();
+
+    std::vector<read_req> reads;
+    for(size_t x = 0; x < que.size(); x++)
+    {
+        read_req req;
+        req.entry = x;
+        req.interval = que[x].interval;
+        req.priority = que[x].priority;
+        const uint8_t* frame = que.frame(x);
+        if(decode_read(frame, que[x].len, req))
+        {
+            reads.push_back(req);
+        } else {
+            /** Not a read, send untouched */
+            RS485_TXN txn = {};
+            txn.offset = frames.size();
+            txn.len = que[x].len;
+            frames.insert(frames.end(), frame, frame + txn.len);
+            txn.slave = frame[0];
+            txn.function = frame[1];
+            txn.interval = que[x].interval;
+            txn.priority = que[x].priority;
+            txn.member_first = members.size();
+            txn.member_num = 1;
+            txn.is_read = false;
+            members.push_back({(uint8_t)x, 0, 0});
+            plan.push_back(txn);
+        }
+    }
+
+    /** Same slave/function/schedule next to each other, ascending start */
+    std::stable_sort(reads.begin(), reads.end(), [](const read_req &a, const read_req &b)
+    {
+        if(a.interval != b.interval) { return a.interval < b.interval; }
+        if(a.priority != b.priority) { return a.priority < b.priority; }
+        if(a.slave != b.slave) { return a.slave < b.slave; }
+        if(a.function != b.function) { return a.function < b.function; }
+        return a.start < b.start;
+    });
+
+    size_t x = 0;
+    while(x < reads.size())
+    {
+        RS485_TXN txn = {};
+        txn.slave = reads[x].slave;
+        txn.function = reads[x].function;
+        txn.start = reads[x].start;
+        txn.interval = reads[x].interval;
+        txn.priority = reads[x].priority;
+        uint32_t end = reads[x].start + reads[x].count;
+        size_t y = x + 1;
+        while(y < reads.size() && reads[y].slave == txn.slave && reads[y].function == txn.function
+            && reads[y].interval == txn.interval && reads[y].priority == txn.priority && reads[y].start <= end)
+        {
+            uint32_t next_end = std::max<uint32_t>(end, reads[y].start + reads[y].count);
+            if(next_end - txn.start > MAX_READ_REGS) { break; }
+            end = next_end;
+            y++;
+        }
+        txn.count = end - txn.start;
+        txn.member_first = members.size();
+        txn.member_num = y - x;
+        txn.is_read = true;
+        for(size_t z = x; z < y; z++)
+        {
+            members.push_back({reads[z].entry, (uint16_t)(reads[z].start - txn.start), reads[z].count});
+        }
+        encode_read(txn, frames);
+        plan.push_back(txn);
+        x = y;
+    }
+
+    /** Keep the bus order close to the queue order */
+    std::stable_sort(plan.begin(), plan.end(), [&members](const RS485_TXN &a, const RS485_TXN &b)
+    {
+        return members[a.member_first].entry < members[b.member_first].entry;
+    });
+}
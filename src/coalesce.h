@@ -0,0 +1,72 @@
+/**
+ * @file coalesce.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-22
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __coalesce_H__
+#define __coalesce_H__
+
+#include <stdint.h>
+#include <vector>
+#include <rs485_msg.h>
+
+/** Max registers in one FC03/FC04 read */
+#define MAX_READ_REGS 125
+
+/**
+ * @brief One queued message inside a bus transaction
+ * 
+ */
+struct RS485_MEMBER
+{
+    /** Index into send_que */
+    uint8_t entry;
+    /** First register, relative to the transaction start */
+    uint16_t offset;
+    /** Registers asked for by the message */
+    uint16_t count;
+};
+
+/**
+ * @brief One frame actually put on the bus
+ * 
+ */
+struct RS485_TXN
+{
+    /** Frame offset/length in the plan arena */
+    uint16_t offset;
+    uint16_t len;
+    uint8_t slave;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+    /** Members live in member_first..member_first+member_num */
+    uint16_t member_first;
+    uint8_t member_num;
+    /** Register read we understand, reply is fanned out per member */
+    bool is_read;
+    /** Schedule shared by all members */
+    uint32_t interval;
+    uint8_t priority;
+};
+
+/**
+ * @brief Build the bus plan for send_que
+ * Reads of neighbouring or overlapping registers on the same
+ * slave/function/schedule collapse into one frame of up to MAX_READ_REGS,
+ * everything else is sent as queued
+ * 
+ * @param que Queued messages
+ * @param plan Output transactions
+ * @param members Output members, indexed by the transactions
+ * @param frames Output frames, indexed by the transactions
+ */
+void coalesce_build(const MSG_QUE &que, std::vector<RS485_TXN> &plan, std::vector<RS485_MEMBER> &members, std::vector<uint8_t> &frames);
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file crc16.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-08-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __crc16_H__
+#define __crc16_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Modbus CRC16 polynomial, reflected 0x8005 */
+#define CRC16_POLY 0xA001
+/** Modbus CRC16 seed */
+#define CRC16_INIT 0xFFFF
+
+/**
+ * @brief 256 entry CRC16 table built at compile time
+ *
+ */
+struct CRC16_TABLE
+{
+    uint16_t value[256];
+
+    constexpr CRC16_TABLE() : value()
+    {
+        for(uint16_t x = 0; x < 256; x++)
+        {
+            uint16_t crc = x;
+            for(uint8_t y = 0; y < 8; y++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC16_POLY : (crc >> 1);
+            }
+            value[x] = crc;
+        }
+    }
+};
+
+/** Lives in flash, nothing built at boot */
+constexpr CRC16_TABLE crc16_table;
+
+/**
+ * @brief Feed one byte into a running CRC
+ *
+ * @param crc Running CRC, start with CRC16_INIT
+ * @param data
+ * @return uint16_t
+ */
+inline uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    return (crc >> 8) ^ crc16_table.value[(crc ^ data) & 0xFF];
+}
+
+/**
+ * @brief Modbus CRC16 of a buffer
+ * Sent on the wire low byte first
+ *
+ * @param data
+ * @param len
+ * @return uint16_t
+ */
+inline uint16_t crc16(const uint8_t* data, size_t len)
+{
+    uint16_t crc = CRC16_INIT;
+    for(size_t x = 0; x < len; x++)
+    {
+        crc = crc16_update(crc, data[x]);
+    }
+    return crc;
+}
+
+#endif
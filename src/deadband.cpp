@@ -0,0 +1,84 @@
+/**
+ * @file deadband.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-06
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <deadband.h>
+#include <decode.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * @brief Should this reading go out
+ * 
+ * @param reading Decoded reading, msg indexes send_que
+ * @param desc Deadband of the message
+ * @param now ms
+ * @return true if it moved past its deadband, is the first or the heartbeat is due
+ */
+bool DEADBAND::report(const READING &reading, const DEADBAND_DESC &desc, uint32_t now)
+{
+    if(desc.absolute <= 0 && desc.percent == 0) { return true; }
+    if(reading.msg >= msgs.size()) { msgs.resize(reading.msg + 1); }
+    LAST_REPORT &last = msgs[reading.msg];
+
+    bool changed = last.raw.size() != reading.count || last.type != reading.type;
+    if(!changed && desc.heartbeat && (now - last.time) >= desc.heartbeat * 1000) { changed = true; }
+    for(uint16_t x = 0; x < reading.count && !changed; x++)
+    {
+        changed = deadband_changed(reading.raw[x], last.raw[x], reading.type, desc);
+    }
+
+    if(!changed)
+    {
+        suppressed++;
+        return false;
+    }
+    last.time = now;
+    last.type = reading.type;
+    last.raw.assign(reading.raw, reading.raw + reading.count);
+    return true;
+}
+
+/**
+ * @brief Raw register as a number, exact for every type
+ * 
+ */
+static double raw_number(int32_t raw, uint8_t type)
+{
+    if(type == REG_U32) { return (uint32_t)raw; }
+    if(type == REG_F32)
+    {
+        float value;
+        memcpy(&value, &raw, sizeof(value));
+        return value;
+    }
+    return raw;
+}
+
+/**
+ * @brief Has one register moved past its deadband
+ * 
+ * @param raw New raw value
+ * @param last Raw value last reported
+ * @param type reg_type_t
+ * @param desc 
+ * @return true 
+ */
+bool deadband_changed(int32_t raw, int32_t last, uint8_t type, const DEADBAND_DESC &desc)
+{
+    double now_value = raw_number(raw, type);
+    double last_value = raw_number(last, type);
+    /** NaN never equals itself, only report it once */
+    if(now_value != now_value || last_value != last_value) { return raw != last; }
+    double diff = fabs(now_value - last_value);
+    if(desc.absolute > 0 && diff > desc.absolute) { return true; }
+    if(desc.percent && diff * 10000 > desc.percent * fabs(last_value)) { return true; }
+    return false;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file deadband.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-06
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __deadband_H__
+#define __deadband_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <reading.h>
+
+/**
+ * @brief Report by exception settings of a message
+ * A register changes once it moves past either threshold
+ * from the value last reported, a zero threshold is off
+ * 
+ */
+struct DEADBAND_DESC
+{
+    /** Raw register units, value units for f32 */
+    float absolute;
+    /** Hundredths of a percent of the last reported value */
+    uint16_t percent;
+    /** Report anyway after this long, s, 0 never */
+    uint32_t heartbeat;
+};
+
+/** Report every reading */
+const DEADBAND_DESC DEADBAND_NONE = {0.0f, 0, 0};
+
+/**
+ * @brief Decides which readings are worth publishing
+ * Compares raw decoded values, never scaled floats
+ * 
+ */
+class DEADBAND
+{
+    public:
+    void clear() { msgs.clear(); }
+    bool report(const READING &reading, const DEADBAND_DESC &desc, uint32_t now);
+
+    /** Readings held back inside their deadband */
+    uint32_t suppressed = 0;
+
+    private:
+    /**
+     * @brief Last reported raw values of a message
+     * 
+     */
+    struct LAST_REPORT
+    {
+        uint32_t time;
+        uint8_t type;
+        std::vector<int32_t> raw;
+    };
+    std::vector<LAST_REPORT> msgs;
+};
+
+bool deadband_changed(int32_t raw, int32_t last, uint8_t type, const DEADBAND_DESC &desc);
+
+#endif
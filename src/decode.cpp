@@ -0,0 +1,48 @@
+/**
+ * @file decode.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-06
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <decode.h>
+
+/** Config names of reg_type_t, in order */
+const char* const REG_TYPE_NAMES[] = {"u16", "s16", "u32", "s32", "f32"};
+
+/**
+ * @brief Build a descriptor from config text
+ * 
+ * @param type u16, s16, u32, s32 or f32
+ * @param order ab for high word first, ba for low word first
+ * @param scale 
+ * @param offset 
+ * @param desc Output
+ * @return true if type and order are known
+ */
+bool decode_parse(const char* type, const char* order, float scale, float offset, DECODE_DESC &desc)
+{
+    int8_t found = -1;
+    for(uint8_t x = 0; x < sizeof(REG_TYPE_NAMES) / sizeof(REG_TYPE_NAMES[0]); x++)
+    {
+        if(strcmp(type, REG_TYPE_NAMES[x]) == 0) { found = x; }
+    }
+    if(found < 0) { return false; }
+
+    if(strcmp(order, "ab") == 0)
+    {
+        desc.order = WORD_HIGH_FIRST;
+    } else if(strcmp(order, "ba") == 0) {
+        desc.order = WORD_LOW_FIRST;
+    } else {
+        return false;
+    }
+    desc.type = found;
+    desc.scale = scale;
+    desc.offset = offset;
+    return true;
+}
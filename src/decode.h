@@ -0,0 +1,173 @@
+/**
+ * @file decode.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-06
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __decode_H__
+#define __decode_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/** Register value types */
+enum reg_type_t : uint8_t
+{
+    REG_U16,
+    REG_S16,
+    REG_U32,
+    REG_S32,
+    REG_F32
+};
+
+/** Word order of 32 bit values */
+enum word_order_t : uint8_t
+{
+    /** High word first, AB CD */
+    WORD_HIGH_FIRST,
+    /** Low word first, CD AB */
+    WORD_LOW_FIRST
+};
+
+/**
+ * @brief How to turn a message's registers into values
+ * value = raw * scale + offset
+ * 
+ */
+struct DECODE_DESC
+{
+    uint8_t type;
+    uint8_t order;
+    float scale;
+    float offset;
+};
+
+/** What the firmware always did, unsigned 16 bit / 10 */
+const DECODE_DESC DECODE_DEFAULT = {REG_U16, WORD_HIGH_FIRST, 0.1f, 0.0f};
+/** Registers as they are, for write echoes */
+const DECODE_DESC DECODE_RAW = {REG_U16, WORD_HIGH_FIRST, 1.0f, 0.0f};
+
+/**
+ * @brief Per type conversion from register bits
+ * raw is the integer value, or the IEEE bits for floats,
+ * so equal raw means an equal reading with no float jitter
+ * 
+ */
+template <uint8_t TYPE> struct REG_TRAITS;
+
+template <> struct REG_TRAITS<REG_U16>
+{
+    static const uint8_t WORDS = 1;
+    static int32_t raw(uint32_t bits) { return (uint16_t)bits; }
+    static float value(uint32_t bits) { return (uint16_t)bits; }
+};
+
+template <> struct REG_TRAITS<REG_S16>
+{
+    static const uint8_t WORDS = 1;
+    static int32_t raw(uint32_t bits) { return (int16_t)bits; }
+    static float value(uint32_t bits) { return (int16_t)bits; }
+};
+
+template <> struct REG_TRAITS<REG_U32>
+{
+    static const uint8_t WORDS = 2;
+    static int32_t raw(uint32_t bits) { return (int32_t)bits; }
+    static float value(uint32_t bits) { return bits; }
+};
+
+template <> struct REG_TRAITS<REG_S32>
+{
+    static const uint8_t WORDS = 2;
+    static int32_t raw(uint32_t bits) { return (int32_t)bits; }
+    static float value(uint32_t bits) { return (int32_t)bits; }
+};
+
+template <> struct REG_TRAITS<REG_F32>
+{
+    static const uint8_t WORDS = 2;
+    static int32_t raw(uint32_t bits) { return (int32_t)bits; }
+    static float value(uint32_t bits)
+    {
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+};
+
+/**
+ * @brief Plain byte array source for decode_block
+ * 
+ */
+struct BYTES_SRC
+{
+    const uint8_t* bytes;
+    uint8_t operator()(uint32_t index) const { return bytes[index]; }
+};
+
+/**
+ * @brief Decode a register block of one type in a single pass
+ * 
+ * @tparam TYPE reg_type_t
+ * @tparam LOW_FIRST 32 bit values sent low word first
+ * @tparam SRC Byte accessor, src(i) is byte i of the block
+ * @param src 
+ * @param regs Registers in the block
+ * @param desc Scale and offset
+ * @param values Output values, regs entries is always enough
+ * @param raw Optional raw output, may be nullptr
+ * @return uint16_t Number of values
+ */
+template <uint8_t TYPE, bool LOW_FIRST, typename SRC>
+uint16_t decode_kernel(const SRC &src, uint16_t regs, const DECODE_DESC &desc, float* values, int32_t* raw)
+{
+    typedef REG_TRAITS<TYPE> traits;
+    uint16_t count = regs / traits::WORDS;
+    for(uint16_t x = 0; x < count; x++)
+    {
+        uint32_t at = x * traits::WORDS * 2;
+        uint32_t bits = (src(at) << 8) | src(at + 1);
+        if(traits::WORDS == 2)
+        {
+            uint32_t next = (src(at + 2) << 8) | src(at + 3);
+            bits = LOW_FIRST ? (next << 16) | bits : (bits << 16) | next;
+        }
+        values[x] = traits::value(bits) * desc.scale + desc.offset;
+        if(raw) { raw[x] = traits::raw(bits); }
+    }
+    return count;
+}
+
+/**
+ * @brief Decode a register block as described
+ * Dispatches once per block to the specialized kernel
+ * 
+ * @param src Byte accessor
+ * @param regs Registers in the block
+ * @param desc 
+ * @param values Output values, regs entries
+ * @param raw Optional raw output, may be nullptr
+ * @return uint16_t Number of values
+ */
+template <typename SRC>
+uint16_t decode_block(const SRC &src, uint16_t regs, const DECODE_DESC &desc, float* values, int32_t* raw)
+{
+    bool low_first = desc.order == WORD_LOW_FIRST;
+    switch(desc.type)
+    {
+        case REG_S16: return decode_kernel<REG_S16, false>(src, regs, desc, values, raw);
+        case REG_U32: return low_first ? decode_kernel<REG_U32, true>(src, regs, desc, values, raw) : decode_kernel<REG_U32, false>(src, regs, desc, values, raw);
+        case REG_S32: return low_first ? decode_kernel<REG_S32, true>(src, regs, desc, values, raw) : decode_kernel<REG_S32, false>(src, regs, desc, values, raw);
+        case REG_F32: return low_first ? decode_kernel<REG_F32, true>(src, regs, desc, values, raw) : decode_kernel<REG_F32, false>(src, regs, desc, values, raw);
+        default: return decode_kernel<REG_U16, false>(src, regs, desc, values, raw);
+    }
+}
+
+bool decode_parse(const char* type, const char* order, float scale, float offset, DECODE_DESC &desc);
+
+#endif
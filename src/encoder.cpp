@@ -0,0 +1,185 @@
+/**
+ * @file encoder.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <encoder.h>
+#include <decode.h>
+#include <string.h>
+
+const ENCODER encoders[PAYLOAD_FORMATS] = {encode_csv, encode_json, encode_cbor};
+
+/**
+ * @brief Text integer
+ * 
+ */
+static void put_int(ENC_WRITER &out, int32_t value)
+{
+    char text[12];
+    out.put(text, format_int(text, value));
+}
+
+/**
+ * @brief Same text as reading_format(), seq,epoch, in front if stamped
+ * 
+ */
+void encode_csv(const READING &reading, bool stamp, ENC_WRITER &out)
+{
+    char text[16];
+    if(stamp)
+    {
+        put_int(out, reading.seq);
+        out.put(',');
+        put_int(out, reading.epoch);
+        out.put(',');
+    }
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        if(x) { out.put(','); }
+        out.put(text, format_float(text, reading.values[x]));
+    }
+}
+
+/**
+ * @brief Compact JSON, values that are not numbers are null
+ * 
+ */
+void encode_json(const READING &reading, bool stamp, ENC_WRITER &out)
+{
+    char text[16];
+    out.put("{\"s\":", 5);
+    put_int(out, reading.seq);
+    out.put(",\"t\":", 5);
+    put_int(out, reading.epoch);
+    out.put(",\"a\":", 5);
+    put_int(out, reading.addr);
+    out.put(",\"m\":", 5);
+    put_int(out, reading.msg + 1);
+    out.put(",\"v\":[", 6);
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        if(x) { out.put(','); }
+        size_t len = format_float(text, reading.values[x]);
+        if(text[len - 1] == 'n' || text[len - 1] == 'f')
+        {
+            out.put("null", 4);
+        } else {
+            out.put(text, len);
+        }
+    }
+    out.put("]}", 2);
+}
+
+/**
+ * @brief CBOR head, major type and argument, shortest form
+ * 
+ */
+static void cbor_head(ENC_WRITER &out, uint8_t major, uint32_t value)
+{
+    major <<= 5;
+    if(value < 24)
+    {
+        out.put(major | value);
+    } else if(value <= 0xFF) {
+        out.put(major | 24);
+        out.put(value);
+    } else if(value <= 0xFFFF) {
+        out.put(major | 25);
+        out.put(value >> 8);
+        out.put(value);
+    } else {
+        out.put(major | 26);
+        out.put(value >> 24);
+        out.put(value >> 16);
+        out.put(value >> 8);
+        out.put(value);
+    }
+}
+
+/**
+ * @brief CBOR integer, major type 0 or 1
+ * 
+ */
+static void cbor_int(ENC_WRITER &out, int32_t value)
+{
+    if(value < 0)
+    {
+        cbor_head(out, 1, -1 - value);
+    } else {
+        cbor_head(out, 0, value);
+    }
+}
+
+/**
+ * @brief CBOR single precision float
+ * 
+ */
+static void cbor_float(ENC_WRITER &out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    out.put(0xFA);
+    out.put(bits >> 24);
+    out.put(bits >> 16);
+    out.put(bits >> 8);
+    out.put(bits);
+}
+
+/**
+ * @brief CBOR array of raw register values and how to scale them
+ * Ints take 1 to 5 bytes each, f32 registers go as floats,
+ * the receiver does value = raw * scale + offset
+ * 
+ */
+void encode_cbor(const READING &reading, bool stamp, ENC_WRITER &out)
+{
+    cbor_head(out, 4, 8);
+    cbor_head(out, 0, reading.seq);
+    cbor_head(out, 0, reading.epoch);
+    cbor_head(out, 0, reading.addr);
+    cbor_head(out, 0, reading.msg + 1);
+    cbor_head(out, 0, reading.type);
+    cbor_float(out, reading.scale);
+    cbor_float(out, reading.offset);
+    cbor_head(out, 4, reading.count);
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        if(reading.type == REG_F32)
+        {
+            float value;
+            memcpy(&value, &reading.raw[x], sizeof(value));
+            cbor_float(out, value);
+        } else if(reading.type == REG_U32) {
+            cbor_head(out, 0, (uint32_t)reading.raw[x]);
+        } else {
+            cbor_int(out, reading.raw[x]);
+        }
+    }
+}
+
+/**
+ * @brief Payload format from its config name
+ * 
+ * @param name csv, json or cbor
+ * @param format Output
+ * @return false if unknown
+ */
+bool encoder_parse(const char* name, uint8_t &format)
+{
+    static const char* names[PAYLOAD_FORMATS] = {"csv", "json", "cbor"};
+    for(uint8_t x = 0; x < PAYLOAD_FORMATS; x++)
+    {
+        if(strcmp(name, names[x]) == 0)
+        {
+            format = x;
+            return true;
+        }
+    }
+    return false;
+}
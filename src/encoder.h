@@ -0,0 +1,88 @@
+/**
+ * @file encoder.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __encoder_H__
+#define __encoder_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <reading.h>
+
+/** Longest value and the comma after it */
+#define ENC_VALUE_MAX (READING_VALUE_MAX + 1)
+/** Longest fields around the values, the JSON {"s":..,"t":..,"a":..,"m":..,"v":[ and ]} */
+#define ENC_HEADER_MAX 64
+/** Fits any reading in any format, JSON is the longest */
+#define ENC_MAX_SIZE (READING_MAX_VALUES * ENC_VALUE_MAX + ENC_HEADER_MAX)
+
+/** Payload formats */
+enum payload_format_t
+{
+    /** values */
+    PAYLOAD_CSV,
+    /** {"s":seq,"t":epoch,"a":addr,"m":msg,"v":[values]} */
+    PAYLOAD_JSON,
+    /** CBOR [seq, epoch, addr, msg, type, scale, offset, [raw]] */
+    PAYLOAD_CBOR,
+    PAYLOAD_FORMATS
+};
+
+/**
+ * @brief Bounded writer over the caller's publish buffer
+ * Encoders write straight into it, nothing is built on the heap
+ * 
+ */
+class ENC_WRITER
+{
+    public:
+    ENC_WRITER(uint8_t* buf, size_t cap) : buf(buf), cap(cap) {}
+
+    void put(uint8_t value)
+    {
+        if(len < cap) { buf[len++] = value; } else { full = true; }
+    }
+
+    void put(const void* data, size_t size)
+    {
+        if(len + size > cap)
+        {
+            full = true;
+            return;
+        }
+        const uint8_t* bytes = (const uint8_t*)data;
+        for(size_t x = 0; x < size; x++) { buf[len + x] = bytes[x]; }
+        len += size;
+    }
+
+    size_t length() const { return len; }
+    /** Something did not fit, the payload is cut short */
+    bool overflow() const { return full; }
+
+    private:
+    uint8_t* buf;
+    size_t cap;
+    size_t len = 0;
+    bool full = false;
+};
+
+/** Encoder entry, stamp adds seq and epoch to formats that leave them out */
+typedef void (*ENCODER)(const READING &reading, bool stamp, ENC_WRITER &out);
+
+void encode_csv(const READING &reading, bool stamp, ENC_WRITER &out);
+void encode_json(const READING &reading, bool stamp, ENC_WRITER &out);
+void encode_cbor(const READING &reading, bool stamp, ENC_WRITER &out);
+
+/** Encoders by payload_format_t */
+extern const ENCODER encoders[PAYLOAD_FORMATS];
+
+bool encoder_parse(const char* name, uint8_t &format);
+
+#endif
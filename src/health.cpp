@@ -0,0 +1,100 @@
+/**
+ * @file health.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <health.h>
+
+/**
+ * @brief May this slave be polled now
+ * Down slaves only get a probe once their backoff ran out
+ * 
+ * @param addr Slave address
+ * @param now millis()
+ * @return true 
+ */
+bool HEALTH::allow(uint8_t addr, uint32_t now)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX) { return true; }
+    SLAVE_HEALTH &slave = slaves[addr];
+    if(slave.state != SLAVE_DOWN) { return true; }
+    return (int32_t)(now - slave.next_probe) >= 0;
+}
+
+/**
+ * @brief Slave answered with a good frame
+ * 
+ * @param addr Slave address
+ * @return true if the state changed
+ */
+bool HEALTH::success(uint8_t addr)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX) { return false; }
+    SLAVE_HEALTH &slave = slaves[addr];
+    bool changed = slave.state != SLAVE_OK;
+    slave.state = SLAVE_OK;
+    slave.fails = 0;
+    slave.backoff = 0;
+    return changed;
+}
+
+/**
+ * @brief Slave timed out or sent a bad frame
+ * 
+ * @param addr Slave address
+ * @param crc Bad CRC or malformed reply rather than timeout
+ * @param now millis()
+ * @return true if the state changed
+ */
+bool HEALTH::failure(uint8_t addr, bool crc, uint32_t now)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX) { return false; }
+    SLAVE_HEALTH &slave = slaves[addr];
+    uint8_t old_state = slave.state;
+    if(crc)
+    {
+        slave.crc_errors++;
+    } else {
+        slave.timeouts++;
+    }
+    if(slave.fails < 255) { slave.fails++; }
+
+    if(slave.fails >= SLAVE_DOWN_FAILS)
+    {
+        /** Each failed probe doubles the wait */
+        if(slave.state == SLAVE_DOWN && slave.backoff < 255) { slave.backoff++; }
+        uint32_t wait = SLAVE_BACKOFF_MIN;
+        for(uint8_t x = 0; x < slave.backoff && wait < SLAVE_BACKOFF_MAX; x++)
+        {
+            wait *= 2;
+        }
+        if(wait > SLAVE_BACKOFF_MAX) { wait = SLAVE_BACKOFF_MAX; }
+        slave.state = SLAVE_DOWN;
+        slave.next_probe = now + wait;
+    } else {
+        slave.state = SLAVE_SUSPECT;
+    }
+    return slave.state != old_state;
+}
+
+/**
+ * @brief Name published for a state
+ * 
+ * @param state 
+ * @return const char* 
+ */
+const char* HEALTH::state_name(uint8_t state)
+{
+    switch(state)
+    {
+        case SLAVE_OK: return "ok";
+        case SLAVE_SUSPECT: return "suspect";
+        default: return "down";
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file health.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __health_H__
+#define __health_H__
+
+#include <stdint.h>
+
+/** Consecutive failures before a slave is marked down */
+#define SLAVE_DOWN_FAILS 3
+/** First probe delay once down, ms */
+#define SLAVE_BACKOFF_MIN 10000
+/** Longest probe delay, ms */
+#define SLAVE_BACKOFF_MAX 600000
+/** Highest Modbus slave address */
+#define SLAVE_ADDR_MAX 247
+
+/** Slave health states */
+enum slave_state_t
+{
+    SLAVE_OK,
+    SLAVE_SUSPECT,
+    SLAVE_DOWN
+};
+
+/**
+ * @brief Per slave circuit breaker state
+ * 
+ */
+struct SLAVE_HEALTH
+{
+    uint8_t state;
+    uint8_t fails;
+    /** Probe delay doubles per failed probe, up to SLAVE_BACKOFF_MAX */
+    uint8_t backoff;
+    uint32_t timeouts;
+    uint32_t crc_errors;
+    uint32_t next_probe;
+};
+
+/**
+ * @brief Circuit breaker per slave address
+ * Dead slaves are only probed on an exponential backoff
+ * and rejoin the polling as soon as they answer again
+ * 
+ */
+class HEALTH
+{
+    public:
+    bool allow(uint8_t addr, uint32_t now);
+    bool success(uint8_t addr);
+    bool failure(uint8_t addr, bool crc, uint32_t now);
+    const SLAVE_HEALTH& get(uint8_t addr) { return slaves[addr]; }
+    static const char* state_name(uint8_t state);
+
+    private:
+    SLAVE_HEALTH slaves[SLAVE_ADDR_MAX + 1] = {};
+};
+
+#endif
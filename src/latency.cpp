@@ -0,0 +1,90 @@
+/**
+ * @file latency.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-28
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <latency.h>
+
+/**
+ * @brief Set up for the bus speed
+ * 
+ * @param baud 
+ */
+void LATENCY::latency_setup(uint32_t baud)
+{
+    /** 11 bits per RTU character */
+    char_us = (11 * 1000000UL + baud - 1) / baud;
+}
+
+/**
+ * @brief How long to wait for the first reply byte
+ * 
+ * @param addr Slave address
+ * @param reply_len Expected reply bytes
+ * @return uint32_t us
+ */
+uint32_t LATENCY::timeout(uint8_t addr, uint16_t reply_len)
+{
+    /** Reply has to fit on the wire after the 3.5 char gap */
+    uint32_t floor = LATENCY_MARGIN + (reply_len * 2 + 7) * char_us / 2;
+    if(addr == 0 || addr > SLAVE_ADDR_MAX || rto[addr] == 0) { return LATENCY_DEFAULT > floor ? LATENCY_DEFAULT : floor; }
+    uint32_t wait = rto[addr];
+    if(wait < floor) { wait = floor; }
+    if(wait > LATENCY_MAX) { wait = LATENCY_MAX; }
+    return wait;
+}
+
+/**
+ * @brief Feed one good transaction
+ * 
+ * @param addr Slave address
+ * @param first_us Request sent to first byte
+ */
+void LATENCY::sample(uint8_t addr, uint32_t first_us)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX) { return; }
+    SLAVE_LATENCY &slave = slaves[addr];
+    if(slave.first == 0)
+    {
+        slave.first = first_us;
+        slave.first_var = first_us / 2;
+    } else {
+        /** Same gains as TCP RTO, 1/8 for the mean and 1/4 for deviation */
+        int32_t err = (int32_t)first_us - (int32_t)slave.first;
+        slave.first += err / 8;
+        if(err < 0) { err = -err; }
+        slave.first_var += ((int32_t)err - (int32_t)slave.first_var) / 4;
+    }
+    rto[addr] = slave.first + 4 * slave.first_var;
+    changed[addr] = true;
+}
+
+/**
+ * @brief Slave missed its timeout, give it longer next time
+ * 
+ * @param addr Slave address
+ */
+void LATENCY::expired(uint8_t addr)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX || rto[addr] == 0) { return; }
+    rto[addr] = rto[addr] * 2 > LATENCY_MAX ? LATENCY_MAX : rto[addr] * 2;
+}
+
+/**
+ * @brief Restore values learned before reboot
+ * 
+ * @param addr Slave address
+ * @param learned 
+ */
+void LATENCY::set(uint8_t addr, const SLAVE_LATENCY &learned)
+{
+    if(addr == 0 || addr > SLAVE_ADDR_MAX || learned.first == 0) { return; }
+    slaves[addr] = learned;
+    rto[addr] = learned.first + 4 * learned.first_var;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file latency.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-28
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __latency_H__
+#define __latency_H__
+
+#include <stdint.h>
+#include <health.h>
+
+/** Timeout before a slave has answered at all, us */
+#define LATENCY_DEFAULT 250000
+/** Longest timeout a slave can earn, us */
+#define LATENCY_MAX 1000000
+/** Slave processing allowance added to the wire time floor, us */
+#define LATENCY_MARGIN 10000
+
+/**
+ * @brief Learned reply latency of one slave
+ * What gets stored in flash
+ * 
+ */
+struct SLAVE_LATENCY
+{
+    /** EWMA of request to first byte, us */
+    uint32_t first;
+    /** EWMA of mean deviation of first, us */
+    uint32_t first_var;
+};
+
+/**
+ * @brief Per slave reply timeout learned from observed latency
+ * timeout = first + 4 * first_var, doubled on every miss,
+ * never below the time the reply needs on the wire
+ * 
+ */
+class LATENCY
+{
+    public:
+    void latency_setup(uint32_t baud);
+    uint32_t timeout(uint8_t addr, uint16_t reply_len);
+    void sample(uint8_t addr, uint32_t first_us);
+    void expired(uint8_t addr);
+    const SLAVE_LATENCY& get(uint8_t addr) { return slaves[addr]; }
+    void set(uint8_t addr, const SLAVE_LATENCY &learned);
+    bool dirty(uint8_t addr) { return addr <= SLAVE_ADDR_MAX && changed[addr]; }
+    void saved(uint8_t addr) { changed[addr] = false; }
+
+    private:
+    uint32_t char_us = 0;
+    SLAVE_LATENCY slaves[SLAVE_ADDR_MAX + 1] = {};
+    /** Current timeout, 0 until the slave has been seen */
+    uint32_t rto[SLAVE_ADDR_MAX + 1] = {};
+    bool changed[SLAVE_ADDR_MAX + 1] = {};
+};
+
+#endif
@@ -13,13 +13,17 @@
 #include <SPI.h>
 #include <SD.h>
 #include <time.h>
-#include <vector>
-#include <sstream>
+#include <esp_system.h>
+#include <decode.h>
+#include <crc16.h>
+#include <lz.h>
+#include <metrics.h>
+#include <stall.h>
+#include <stddef.h>
+#include <atomic>
 
 /** Configurage switch */
 bool use_sd = true;
-/** Logic switch */
-bool use_log = false;
 /** Card found switch */
 bool card_found = false;
 /** Time server */
@@ -28,6 +32,54 @@ String ntp_server = "pool.ntp.org";
 int32_t gmtoffset_sec = 0;
 /** Daylight savings time offset */
 uint32_t daylightoffset_sec = 0;
+/** Max time a record waits in RAM before hitting the card, ms */
+uint32_t sd_flush_time = 10000;
+/** Write buffer, a multiple of the 512 byte sector */
+#define SD_BUFFER_SIZE 4096
+/** Records waiting for the card */
+uint8_t sd_buffer[SD_BUFFER_SIZE];
+/** Bytes used in sd_buffer */
+size_t sd_fill = 0;
+/** Last flush, ms */
+uint32_t sd_last_flush = 0;
+/** Write/flush stats */
+LOGGER_STATS sd_stats;
+/** Text or binary log */
+uint8_t sd_format = LOG_TEXT;
+/** Header of the binary block being filled */
+LOG_BLOCK_HEADER sd_header;
+/** Binary block as written, header then packed records */
+uint8_t sd_packed[sizeof(LOG_BLOCK_HEADER) + SD_BUFFER_SIZE];
+/** Segment size, KB */
+uint32_t sd_segment_kb = 1024;
+/** Most the log may take up, MB */
+uint32_t sd_budget_mb = 64;
+/** Oldest and current segment number, 0 until the card is scanned */
+uint32_t seg_first = 0;
+uint32_t seg_last = 0;
+/** Write offset in the current segment */
+uint32_t seg_pos = 0;
+/** Segment file extension by log format */
+const char* seg_ext[] = {".txt", ".bin"};
+
+/** Whoever holds the card, the RS485 task writing or shutdown closing it */
+std::atomic<bool> sd_busy{false};
+
+/**
+ * @brief Try to take the card for its scope
+ * Nothing waits, the loser of a race with shutdown leaves the card alone
+ * 
+ */
+struct SD_BUSY
+{
+  bool held;
+  SD_BUSY()
+  {
+    bool idle = false;
+    held = sd_busy.compare_exchange_strong(idle, true, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+  ~SD_BUSY() { if(held) { sd_busy.store(false, std::memory_order_release); } }
+};
 
 /** Turn on/off LOGGER debug output*/
 #define LOGGER_DEBUG 1
@@ -36,10 +88,19 @@ uint32_t daylightoffset_sec = 0;
 File r4k_file;
 
 void setup_sd();
+bool open_sd();
+void scan_sd();
+void segment_path(char* buf, size_t size, uint32_t num, uint8_t format);
+uint32_t segment_end();
+void roll_sd();
+void flush_sd();
+void write_bin(const READING &reading);
+size_t pack_block();
+void shutdown_sd();
 void setup_rtc();
-String get_timestamp();
-String parse_data_sd(String data);
+size_t get_timestamp(char* buf, size_t size);
 void LOGGER_LOG(String chan, String data);
+void LOGGER_LOG(const char* chan, const char* data);
 
 /**
  * @brief Setup logger
@@ -67,98 +128,419 @@ void setup_sd()
     } else {
       LOGGER_LOG("LOG", "SD init success");
       card_found = true;
+      open_sd();
+      /** Whatever is buffered goes to the card on ESP.restart() */
+      esp_register_shutdown_handler(shutdown_sd);
+    }
+  }
+}
+
+/**
+ * @brief Open the current segment once and keep it open
+ * Every open/close rewrites the FAT and directory sectors
+ * 
+ * @return true 
+ */
+bool open_sd()
+{
+  if(!r4k_file)
+  {
+    if(seg_last == 0) { scan_sd(); }
+    char path[24];
+    segment_path(path, sizeof(path), seg_last, sd_format);
+    if(sd_format == LOG_BINARY)
+    {
+      bool fresh = !SD.exists(path);
+      r4k_file = SD.open(path, fresh ? FILE_WRITE : "r+");
+      if(r4k_file)
+      {
+        seg_pos = fresh ? 0 : segment_end();
+        /** Claim the whole segment now so the FAT is not touched again until the next one */
+        uint32_t size = sd_segment_kb * 1024;
+        if(r4k_file.size() < size)
+        {
+          r4k_file.seek(size - 1);
+          r4k_file.write((uint8_t)0);
+          r4k_file.flush();
+        }
+      }
+    } else {
+      r4k_file = SD.open(path, FILE_APPEND);
+      if(r4k_file) { seg_pos = r4k_file.size(); }
     }
+    if(!r4k_file) { LOGGER_LOG("LOG", "Could not open log file"); }
+  }
+  return r4k_file;
+}
+
+/**
+ * @brief Find the oldest and newest segment on the card
+ * Segments of both formats share the numbering and the budget
+ * 
+ */
+void scan_sd()
+{
+  seg_first = 0;
+  seg_last = 0;
+  /** Format of the newest segment */
+  uint8_t last_format = sd_format;
+  if(!SD.exists(LOG_DIR)) { SD.mkdir(LOG_DIR); }
+  File dir = SD.open(LOG_DIR);
+  if(dir)
+  {
+    File entry = dir.openNextFile();
+    while(entry)
+    {
+      const char* name = entry.name();
+      const char* base = strrchr(name, '/');
+      base = base ? base + 1 : name;
+      char* end;
+      uint32_t num = strtoul(base, &end, 10);
+      for(uint8_t format = LOG_TEXT; format <= LOG_BINARY; format++)
+      {
+        if(num == 0 || strcmp(end, seg_ext[format]) != 0) { continue; }
+        if(seg_first == 0 || num < seg_first) { seg_first = num; }
+        if(num > seg_last || (num == seg_last && format == sd_format))
+        {
+          seg_last = num;
+          last_format = format;
+        }
+      }
+      entry = dir.openNextFile();
+    }
+    dir.close();
+  }
+  if(seg_last == 0)
+  {
+    seg_first = 1;
+    seg_last = 1;
+  } else if(last_format != sd_format) {
+    /** Format changed, start a fresh segment after the old ones */
+    seg_last++;
+  }
+
+  char stats[64];
+  snprintf(stats, sizeof(stats), "Segments %u to %u", (unsigned)seg_first, (unsigned)seg_last);
+  LOGGER_LOG("LOG", stats);
+}
+
+/**
+ * @brief Path of a segment file
+ * 
+ * @param buf 
+ * @param size 
+ * @param num Segment number
+ * @param format LOG_TEXT or LOG_BINARY
+ */
+void segment_path(char* buf, size_t size, uint32_t num, uint8_t format)
+{
+  snprintf(buf, size, LOG_DIR "/%08u%s", (unsigned)num, seg_ext[format]);
+}
+
+/**
+ * @brief Walk the block headers of a binary segment
+ * 
+ * @return uint32_t Offset just past the last good block
+ */
+uint32_t segment_end()
+{
+  uint32_t pos = 0;
+  uint32_t size = r4k_file.size();
+  LOG_BLOCK_HEADER header;
+  while(pos + sizeof(header) <= size)
+  {
+    r4k_file.seek(pos);
+    if(r4k_file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) { break; }
+    size_t skip = offsetof(LOG_BLOCK_HEADER, len);
+    if(header.magic != LOG_BLOCK_MAGIC || header.crc != crc16((uint8_t*)&header + skip, sizeof(header) - skip)) { break; }
+    if(pos + sizeof(header) + header.len > size) { break; }
+    pos += sizeof(header) + header.len;
+  }
+  return pos;
+}
+
+/**
+ * @brief Close the current segment, start the next
+ * and drop the oldest until the log fits the budget
+ * 
+ */
+void roll_sd()
+{
+  r4k_file.close();
+  seg_last++;
+  seg_pos = 0;
+  sd_stats.rolled++;
+
+  uint64_t segment = sd_segment_kb * 1024ULL;
+  uint64_t budget = sd_budget_mb * 1048576ULL;
+  while(seg_first < seg_last && (seg_last - seg_first + 1) * segment > budget)
+  {
+    /** Either format, whichever the segment was written in */
+    for(uint8_t format = LOG_TEXT; format <= LOG_BINARY; format++)
+    {
+      char path[24];
+      segment_path(path, sizeof(path), seg_first, format);
+      if(SD.remove(path)) { LOGGER_LOG("LOG", path); }
+    }
+    seg_first++;
+    sd_stats.pruned++;
   }
 }
 
 /**
  * @brief Write to SD card
+ * Records collect in RAM and reach the card a full
+ * buffer at a time, or every sd_flush_time
  * 
- * @param data String to write to SD log file
+ * @param reading Reading to append to the SD log file
  */
-void LOGGER::write_sd(String data)
+void LOGGER::write_sd(const READING &reading)
 {
-  if(use_sd && card_found && use_log)
+  if(use_sd && card_found)
   {
-    r4k_file = SD.open("/rs485log.txt", FILE_APPEND);
-    data = parse_data_sd(data);
+    SD_BUSY busy;
+    if(!busy.held) { return; }
+    if(sd_format == LOG_BINARY)
+    {
+      write_bin(reading);
+      return;
+    }
+
+    static char log_data[READING_TEXT_SIZE + 32];
+    size_t len = get_timestamp(log_data, 32);
+    log_data[len++] = ' ';
+    len += reading_format(reading, ", ", false, log_data + len, sizeof(log_data) - len - 2);
+    log_data[len++] = '\r';
+    log_data[len++] = '\n';
 
-    if(r4k_file)
+    /** Top up the buffer, full buffers go out whole so writes stay sector aligned */
+    size_t done = 0;
+    while(done < len)
     {
-      r4k_file.println(get_timestamp() + " " + data);
-      LOGGER_LOG("LOG", "Wrote " + get_timestamp() + " " + data);
-      r4k_file.close();
-    } else {
-      LOGGER_LOG("LOG", "Could not open log file");
+      size_t chunk = len - done;
+      if(chunk > SD_BUFFER_SIZE - sd_fill) { chunk = SD_BUFFER_SIZE - sd_fill; }
+      memcpy(sd_buffer + sd_fill, log_data + done, chunk);
+      sd_fill += chunk;
+      done += chunk;
+      if(sd_fill == SD_BUFFER_SIZE) { flush_sd(); }
     }
   }
 }
 
 /**
- * @brief Set up real time clock
+ * @brief Append a binary record to the current block
  * 
+ * @param reading 
  */
-void setup_rtc()
+void write_bin(const READING &reading)
 {
-  struct tm timeinfo;
-  configTime(gmtoffset_sec, daylightoffset_sec, ntp_server.c_str());
-  if(!getLocalTime(&timeinfo))
+  uint8_t width = reading.type >= REG_U32 ? 4 : 2;
+  size_t len = sizeof(LOG_RECORD) + reading.count * width;
+  if(sd_fill + len > SD_BUFFER_SIZE) { flush_sd(); }
+
+  LOG_RECORD record;
+  record.epoch = reading.epoch;
+  record.addr = reading.addr;
+  record.msg = reading.msg;
+  record.type = reading.type;
+  record.count = reading.count;
+  memcpy(sd_buffer + sd_fill, &record, sizeof(record));
+  uint8_t* out = sd_buffer + sd_fill + sizeof(record);
+  for(uint16_t x = 0; x < reading.count; x++)
   {
-    LOGGER_LOG("LOG", "Failed to obtain time");
-    LOGGER_LOG("LOG", "Using defaults");
-  } else {
-    LOGGER_LOG("LOG", "Got time from " + String(ntp_server));
+    uint32_t raw = reading.raw[x];
+    for(uint8_t y = 0; y < width; y++)
+    {
+      *out++ = raw >> (8 * y);
+    }
   }
+
+  if(sd_header.records == 0) { sd_header.first = record.epoch; }
+  sd_header.last = record.epoch;
+  sd_header.records++;
+  sd_header.slaves[reading.addr / 8] |= 1 << (reading.addr % 8);
+  sd_fill += len;
 }
 
 /**
- * @brief Get the timestamp object
+ * @brief Compress the binary block in the buffer into sd_packed
+ * and put the header on it
  * 
- * @return String 
+ * @return size_t Bytes to write
  */
-String get_timestamp()
+size_t pack_block()
 {
-  struct tm timeinfo;
-  String timestamp;
-  if(!getLocalTime(&timeinfo))
+  uint8_t* out = sd_packed + sizeof(LOG_BLOCK_HEADER);
+  /** Stored as is when packing would not save anything */
+  size_t len = lz_compress(sd_buffer, sd_fill, out, sd_fill > 1 ? sd_fill - 1 : 0);
+  if(len == 0)
   {
-    LOGGER_LOG("LOG", "Failed to obtain time");
-  } else {
-    char time_c[100];
-    strftime(time_c, 50, "%D %T", &timeinfo);
-    timestamp = String(time_c);
+    memcpy(out, sd_buffer, sd_fill);
+    len = sd_fill;
   }
 
-  return timestamp;
+  size_t skip = offsetof(LOG_BLOCK_HEADER, len);
+  sd_header.magic = LOG_BLOCK_MAGIC;
+  sd_header.len = len;
+  sd_header.raw_len = sd_fill;
+  sd_header.crc = crc16((uint8_t*)&sd_header + skip, sizeof(sd_header) - skip);
+  memcpy(sd_packed, &sd_header, sizeof(sd_header));
+  memset(&sd_header, 0, sizeof(sd_header));
+  return sizeof(LOG_BLOCK_HEADER) + len;
+}
+
+/**
+ * @brief Flush the write buffer when it is due
+ * 
+ */
+void LOGGER::logger_loop()
+{
+  if(sd_fill > 0 && (millis() - sd_last_flush) >= sd_flush_time)
+  {
+    SD_BUSY busy;
+    if(busy.held) { flush_sd(); }
+  }
+}
+
+/**
+ * @brief Append a timestamped line to a file of its own
+ * Opened and closed each time, for rare notes outside the log
+ * 
+ * @param path 
+ * @param text 
+ * @return false if there is no card or the write failed
+ */
+bool LOGGER::logger_note(const char* path, const char* text)
+{
+  if(!use_sd || !card_found) { return false; }
+  SD_BUSY busy;
+  if(!busy.held) { return false; }
+  File note = SD.open(path, FILE_APPEND);
+  if(!note) { return false; }
+  char stamp[32];
+  size_t len = get_timestamp(stamp, sizeof(stamp));
+  stamp[len++] = ' ';
+  bool ok = note.write((const uint8_t*)stamp, len) == len;
+  ok &= note.write((const uint8_t*)text, strlen(text)) == strlen(text);
+  ok &= note.write((const uint8_t*)"\r\n", 2) == 2;
+  note.close();
+  return ok;
+}
+
+/**
+ * @brief Write/flush stats
+ * 
+ * @return const LOGGER_STATS& 
+ */
+const LOGGER_STATS& LOGGER::logger_stats()
+{
+  return sd_stats;
 }
 
 /**
- * @brief Parse incoming string to csv
+ * @brief Write the buffer to the card and sync it
  * 
- * @param data 
  */
-String parse_data_sd(String data)
+void flush_sd()
 {
-  String log_data;
-  std::stringstream ss(data.c_str());
-  std::string segment;
-  std::vector<std::string> seglist;
-  while(std::getline(ss, segment, '+'))
+  sd_last_flush = millis();
+  const uint8_t* data = sd_buffer;
+  size_t raw = sd_fill;
+  size_t len = sd_fill;
+  if(sd_format == LOG_BINARY)
   {
-      seglist.push_back(segment);
+    len = pack_block();
+    data = sd_packed;
   }
+  sd_fill = 0;
+  if(open_sd() && seg_pos > 0 && seg_pos + len > sd_segment_kb * 1024)
+  {
+    roll_sd();
+  }
+  if(!open_sd())
+  {
+    metrics.count(M_SD_FAIL);
+    sd_stats.failed++;
+    return;
+  }
+
+  uint32_t start = micros();
+  if(sd_format == LOG_BINARY) { r4k_file.seek(seg_pos); }
+  size_t written = r4k_file.write(data, len);
+  r4k_file.flush();
+  uint32_t took = micros() - start;
 
-  uint16_t size = seglist.size();
-  for(int x = 0; x < size; x++)
+  metrics.record(M_SD_US, took);
+  if(written != len)
   {
-      if (x == size-1) {
-          log_data += String(seglist[x].c_str());
-      } else {
-          log_data += String(seglist[x].c_str()) + ", ";
-      }
+    /** Reopen next time, the card may have been pulled */
+    LOGGER_LOG("LOG", "SD write failed");
+    metrics.count(M_SD_FAIL);
+    sd_stats.failed++;
+    r4k_file.close();
   }
+  seg_pos += written;
+  sd_stats.bytes += written;
+  sd_stats.raw_bytes += raw;
+  sd_stats.flushes++;
+  sd_stats.flush_us_total += took;
+  sd_stats.flush_us_last = took;
+  if(took > sd_stats.flush_us_max) { sd_stats.flush_us_max = took; }
+
+  char stats[80];
+  uint32_t rate = sd_stats.bytes * 1000000ULL / (sd_stats.flush_us_total ? sd_stats.flush_us_total : 1);
+  snprintf(stats, sizeof(stats), "Flushed %uB of %uB in %uus, %uB/s", (unsigned)written, (unsigned)raw, (unsigned)took, (unsigned)rate);
+  LOGGER_LOG("LOG", stats);
+}
 
-  return log_data;
+/**
+ * @brief Last chance to save buffered records
+ * Skipped if a write holds the card, it may be the one stuck.
+ * The card is never given back, writes after this are dropped
+ * 
+ */
+void shutdown_sd()
+{
+  bool idle = false;
+  if(!sd_busy.compare_exchange_strong(idle, true, std::memory_order_acquire, std::memory_order_relaxed)) { return; }
+  if(sd_fill > 0) { flush_sd(); }
+  r4k_file.close();
+}
+
+/**
+ * @brief Set up real time clock
+ * 
+ */
+void setup_rtc()
+{
+  struct tm timeinfo;
+  configTime(gmtoffset_sec, daylightoffset_sec, ntp_server.c_str());
+  if(!getLocalTime(&timeinfo))
+  {
+    LOGGER_LOG("LOG", "Failed to obtain time");
+    LOGGER_LOG("LOG", "Using defaults");
+  } else {
+    LOGGER_LOG("LOG", "Got time from " + String(ntp_server));
+  }
+}
+
+/**
+ * @brief Get the timestamp object
+ * 
+ * @param buf Output, empty if the time is unknown
+ * @param size 
+ * @return size_t Length written
+ */
+size_t get_timestamp(char* buf, size_t size)
+{
+  struct tm timeinfo;
+  buf[0] = 0;
+  if(!getLocalTime(&timeinfo, 0))
+  {
+    LOGGER_LOG("LOG", "Failed to obtain time");
+    return 0;
+  }
+  return strftime(buf, size, "%D %T", &timeinfo);
 }
 
 /**
@@ -170,7 +552,25 @@ String parse_data_sd(String data)
 void LOGGER_LOG(String chan, String data)
 {
     #if LOGGER_DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
     String disp = "["+chan+"] " + data;
     Serial.println(disp);
     #endif
 }
+
+/**
+ * @brief Debug output text without touching the heap
+ * 
+ * @param chan Output channel
+ * @param data Text to output
+ */
+void LOGGER_LOG(const char* chan, const char* data)
+{
+    #if LOGGER_DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
+    Serial.print("[");
+    Serial.print(chan);
+    Serial.print("] ");
+    Serial.println(data);
+    #endif
+}
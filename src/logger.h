@@ -11,6 +11,96 @@
 #ifndef __logger_H__
 #define __logger_H__
 
+#include <reading.h>
+
+/** SD log formats */
+#define LOG_TEXT 0
+#define LOG_BINARY 1
+
+/**
+ * SD log segments
+ * 
+ * The log is a run of numbered segment files in /log, 00000001.txt
+ * or 00000001.bin and up. A segment is closed once it reaches
+ * sd_segment_kb and the oldest segments are removed to keep the
+ * log under sd_budget_mb. Both formats share the numbering and the
+ * budget, so segments from before a format change are removed too.
+ * Text segments are plain appended lines that stay readable as is,
+ * only binary segments are preallocated and compressed.
+ * 
+ */
+#define LOG_DIR "/log"
+
+/**
+ * Binary log
+ * 
+ * Binary segments are preallocated to their full size when opened
+ * and filled front to back with blocks, each a LOG_BLOCK_HEADER then
+ * up to 4 KB of records, lz compressed unless that did not save
+ * anything. A reader walks the headers from the front, reading only
+ * the blocks whose time range and slave set it needs, and stops at
+ * the first header with a bad magic or CRC, the unwritten tail.
+ * All fields are little endian.
+ * 
+ */
+#define LOG_BLOCK_MAGIC 0x32424C52
+
+/**
+ * @brief Binary record header
+ * Followed by count values of the reading's type, 2 bytes
+ * for 16 bit types and 4 bytes for 32 bit types, raw as read
+ * off the bus with 32 bit values high word first
+ * 
+ */
+struct LOG_RECORD
+{
+    uint32_t epoch;
+    uint8_t addr;
+    uint8_t msg;
+    uint8_t type;
+    uint8_t count;
+};
+
+/**
+ * @brief Binary block header
+ * 
+ */
+struct LOG_BLOCK_HEADER
+{
+    uint32_t magic;
+    /** Modbus CRC16 of the header from len on */
+    uint16_t crc;
+    /** Block bytes after this header */
+    uint16_t len;
+    /** Record bytes once unpacked, equal to len if stored as is */
+    uint16_t raw_len;
+    uint16_t records;
+    /** Epoch of the first and last record */
+    uint32_t first;
+    uint32_t last;
+    /** Bit N set if slave N has a record in the block */
+    uint8_t slaves[32];
+};
+
+/**
+ * @brief SD write stats
+ * 
+ */
+struct LOGGER_STATS
+{
+    uint64_t bytes;
+    /** Bytes before compression */
+    uint64_t raw_bytes;
+    /** Segments closed and removed */
+    uint32_t rolled;
+    uint32_t pruned;
+    uint32_t flushes;
+    uint32_t failed;
+    uint64_t flush_us_total;
+    uint32_t flush_us_last;
+    uint32_t flush_us_max;
+};
+
 /**
  * @brief LOGGER Lib
  * 
@@ -19,12 +109,19 @@ class LOGGER
 {
     public:
     void logger_setup();
-    void write_sd(String data);
+    void logger_loop();
+    void write_sd(const READING &reading);
+    bool logger_note(const char* path, const char* text);
+    const LOGGER_STATS& logger_stats();
 };
 
 /** Overloads for logic */
-extern bool use_log;
+extern bool card_found;
 extern int32_t gmtoffset_sec;
 extern uint32_t daylightoffset_sec;
+extern uint32_t sd_flush_time;
+extern uint8_t sd_format;
+extern uint32_t sd_segment_kb;
+extern uint32_t sd_budget_mb;
 
 #endif
@@ -0,0 +1,164 @@
+/**
+ * @file lz.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <lz.h>
+#include <string.h>
+
+/** Last position of each 4 byte hash */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+/**
+ * @brief Read 4 bytes, any alignment
+ * 
+ */
+static uint32_t read32(const uint8_t* at)
+{
+    uint32_t value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Write a nibble overflow as 255 continued bytes
+ * 
+ * @return false if out of room
+ */
+static bool put_length(uint8_t* out, size_t &op, size_t cap, size_t value)
+{
+    while(value >= 255)
+    {
+        if(op >= cap) { return false; }
+        out[op++] = 255;
+        value -= 255;
+    }
+    if(op >= cap) { return false; }
+    out[op++] = value;
+    return true;
+}
+
+/**
+ * @brief Write one sequence
+ * 
+ * @param match_len 0 for the closing literals only sequence
+ * @return false if out of room
+ */
+static bool put_sequence(const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len, uint8_t* out, size_t &op, size_t cap)
+{
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    if(op >= cap) { return false; }
+    out[op++] = ((lit_len < 15 ? lit_len : 15) << 4) | (match_code < 15 ? match_code : 15);
+    if(lit_len >= 15 && !put_length(out, op, cap, lit_len - 15)) { return false; }
+    if(op + lit_len > cap) { return false; }
+    memcpy(out + op, lit, lit_len);
+    op += lit_len;
+    if(match_len == 0) { return true; }
+    if(op + 2 > cap) { return false; }
+    out[op++] = offset & 0xFF;
+    out[op++] = offset >> 8;
+    if(match_code >= 15 && !put_length(out, op, cap, match_code - 15)) { return false; }
+    return true;
+}
+
+/**
+ * @brief Compress a block
+ * 
+ * @param in 
+ * @param len Up to 64 KB
+ * @param out 
+ * @param cap Room in out
+ * @return size_t Compressed length, 0 if it did not fit in cap
+ */
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap)
+{
+    memset(lz_table, 0, sizeof(lz_table));
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    while(ip + LZ_MIN_MATCH <= len)
+    {
+        uint32_t seq = read32(in + ip);
+        uint32_t hash = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+        size_t ref = lz_table[hash];
+        lz_table[hash] = ip;
+        if(ref < ip && read32(in + ref) == seq)
+        {
+            size_t match_len = LZ_MIN_MATCH;
+            while(ip + match_len < len && in[ref + match_len] == in[ip + match_len])
+            {
+                match_len++;
+            }
+            if(!put_sequence(in + anchor, ip - anchor, ip - ref, match_len, out, op, cap)) { return 0; }
+            ip += match_len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    if(!put_sequence(in + anchor, len - anchor, 0, 0, out, op, cap)) { return 0; }
+    return op;
+}
+
+/**
+ * @brief Read a nibble overflow
+ * 
+ * @return false if the input ran out
+ */
+static bool get_length(const uint8_t* in, size_t &ip, size_t len, size_t &value)
+{
+    uint8_t next;
+    do
+    {
+        if(ip >= len) { return false; }
+        next = in[ip++];
+        value += next;
+    } while(next == 255);
+    return true;
+}
+
+/**
+ * @brief Decompress a block
+ * 
+ * @param in 
+ * @param len Compressed length
+ * @param out 
+ * @param cap Room in out
+ * @return size_t Decompressed length, 0 if the block is corrupt
+ */
+size_t lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t cap)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    while(ip < len)
+    {
+        uint8_t token = in[ip++];
+        size_t lit_len = token >> 4;
+        if(lit_len == 15 && !get_length(in, ip, len, lit_len)) { return 0; }
+        if(ip + lit_len > len || op + lit_len > cap) { return 0; }
+        memcpy(out + op, in + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if(ip >= len) { break; }
+
+        if(ip + 2 > len) { return 0; }
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if(match_len == 15 && !get_length(in, ip, len, match_len)) { return 0; }
+        match_len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op || op + match_len > cap) { return 0; }
+        /** Byte by byte, matches may overlap themselves */
+        for(size_t x = 0; x < match_len; x++, op++)
+        {
+            out[op] = out[op - offset];
+        }
+    }
+    return op;
+}
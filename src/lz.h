@@ -0,0 +1,34 @@
+/**
+ * @file lz.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __lz_H__
+#define __lz_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Small LZ77 block codec, LZ4 style sequences
+ * 
+ * token: high nibble literal count, low nibble match length - 4,
+ * a nibble of 15 is continued by bytes added on until one is not 255,
+ * then the literals, then a 2 byte little endian match offset.
+ * The last sequence is literals only. The compressor needs a
+ * 2 KB hash table and nothing else, blocks up to 64 KB.
+ * 
+ */
+#define LZ_HASH_BITS 10
+#define LZ_MIN_MATCH 4
+
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap);
+size_t lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t cap);
+
+#endif
@@ -16,6 +16,22 @@
 #include <MQTT.h>
 #include <logger.h>
 #include <Preferences.h>
+#include <ring_buffer.h>
+#include <crc16.h>
+#include <modbus.h>
+#include <coalesce.h>
+#include <scheduler.h>
+#include <health.h>
+#include <latency.h>
+#include <decode.h>
+#include <reading.h>
+#include <alloc_count.h>
+#include <spsc_ring.h>
+#include <encoder.h>
+#include <deadband.h>
+#include <aggregate.h>
+#include <metrics.h>
+#include <stall.h>
 
 /** MQTT Lib */
 MQTT mqtt_lib;
@@ -23,31 +39,132 @@ MQTT mqtt_lib;
 LOGGER logger_lib;
 /** Preferences instance */
 Preferences flash_storage;
-/** RS485 reply message que */
-std::vector<int> reply_que;
+/** UART driver RX buffer, holds a full frame while TLS blocks loop() */
+#define UART_RX_SIZE 1024
+/** RS485 reply ring, power of two */
+#define REPLY_RING_SIZE 1024
+/** RS485 reply ring */
+RING_BUFFER<REPLY_RING_SIZE> reply_ring;
+/** Reply ring as a decode_block() byte source */
+struct RING_SRC
+{
+    uint32_t base;
+    uint8_t operator()(uint32_t index) const { return reply_ring.at(base + index); }
+};
+/** Reply frame start/end offsets into reply_ring */
+uint32_t frame_start;
+uint32_t frame_end;
+/** Replies dropped for a bad CRC */
+uint32_t crc_errors;
+/** Reading being decoded, handed to every sink */
+READING reading;
+/** Sequence number of the last reading */
+uint32_t reading_seq;
+/** Heap allocations made by the last rs485_read(), the net task is not counted */
+uint32_t read_allocs;
 /** RS485 send que */
-std::vector<std::array<uint8_t, 8>> send_que;
+MSG_QUE send_que;
+/** Bus transactions built from send_que */
+std::vector<RS485_TXN> rs485_txns;
+/** Frames of the bus transactions */
+std::vector<uint8_t> rs485_frames;
+/** send_que entries carried by each transaction */
+std::vector<RS485_MEMBER> rs485_members;
+/** Per transaction poll schedule */
+SCHEDULER rs485_sched;
+/** Per slave circuit breaker */
+HEALTH slave_health;
+/** Readings waiting for the network task, power of two */
+#define READING_RING_SIZE 16
+/** Readings handed from the RS485 task to the network task */
+SPSC_RING<READING, READING_RING_SIZE> reading_ring;
+/** Slave health change for the network task */
+struct STATUS_MSG
+{
+    uint8_t addr;
+    SLAVE_HEALTH health;
+};
+/** Health changes handed to the network task */
+SPSC_RING<STATUS_MSG, 16> status_ring;
+/** MQTT/WiFi/SD task, on the core the WiFi stack runs on */
+#define NET_TASK_CORE 0
+#define NET_TASK_STACK 10240
+TaskHandle_t net_handle;
+/** Report by exception state per message */
+DEADBAND reading_deadband;
+/** Window summaries per message */
+AGGREGATE reading_aggregate;
+/** Aggregation window, s, 0 publishes every reading */
+uint32_t agg_window = 0;
+/** Still log every sample to SD while aggregating */
+bool agg_raw = false;
+/** Longest loop() may go without a pass before the watchdog resets, ms */
+#define RS485_WDT_TIME 10000
+/** Same for the network task, a TLS connect alone may take 2 x MQTT_CONNECT_TIME */
+#define NET_WDT_TIME 60000
+/** Watchdog dump from before a reset, on the SD card */
+#define STALL_FILE "/stall.txt"
+/** Per slave learned reply timeout */
+LATENCY slave_latency;
+/** How often learned timeouts are saved to flash, ms */
+#define LATENCY_SAVE_TIME 900000
 /** Read time interval */
 uint64_t delay_time;
 /** Set sensor baud rate */
 uint32_t baud_rate;
-/** Is RS485 busy */
-bool busy = false;
-/** Sensor read count */
-uint8_t sensor_count;
+/** RS485 master states */
+enum rs485_state_t
+{
+    RS485_IDLE,
+    RS485_TX,
+    RS485_WAIT_REPLY,
+    RS485_RX,
+    RS485_DONE,
+    RS485_TIMEOUT
+};
+/** Current RS485 master state */
+rs485_state_t rs485_state = RS485_IDLE;
+/** Frame in flight */
+uint8_t tx_frame[MODBUS_MAX_FRAME];
+/** Length of the frame in flight */
+uint16_t tx_len;
+/** Publish the reply of the frame in flight */
+bool tx_mqtt;
+/** Transaction in flight, -1 for one time messages */
+int16_t tx_txn = -1;
+/** Time the frame in flight finished sending */
+uint32_t tx_time;
+/** Time the last byte was seen on the bus */
+uint32_t rx_time;
+/** Time the first reply byte was seen */
+uint32_t first_rx_time;
+/** Reply timeout of the frame in flight in us */
+uint32_t tx_timeout;
+/** Modbus 3.5 character silence in us */
+uint32_t silence_time;
 /** Number of read messages */
 uint8_t read_num;
 /** Retry one time message? */
 bool onetime_retry;
 /** One time message */
-uint8_t onetime_msg[8];
+uint8_t onetime_msg[MODBUS_MAX_FRAME];
+uint16_t onetime_len;
 /** Turn on/off debug output */
 #define DEBUG 1
 
 /** Forward declaration */
-void rs485_send();
-void rs485_read(bool mqtt_send);
+void rs485_send(uint8_t txn);
+void rs485_begin(const uint8_t* value, uint16_t len, bool mqtt_send, int16_t txn);
+void rs485_loop();
+bool rs485_read(bool mqtt_send);
+void rs485_health(bool ok, bool crc);
+void flash_latency(bool load);
+void rs485_decode(uint32_t data, uint16_t regs, const DECODE_DESC &desc, uint8_t msg);
+void rs485_decode_bits(uint32_t data, uint16_t bits);
+void rs485_report(bool mqtt_send);
+void net_task(void* param);
 void R_LOG(String chan, String data);
+void R_LOG(const char* chan, const char* data);
 
 /**
  * @brief Setup firmware
@@ -72,6 +189,9 @@ void setup()
         }
     }
 
+    /** Heap use of the read path is counted for this task */
+    alloc_track();
+
     /** Initialize flash storage */
     R_LOG("FLASH", "Starting flash storage");
     flash_storage.begin("RS485", false);
@@ -83,26 +203,55 @@ void setup()
     R_LOG("FLASH", "Read: Delay time " + String(delay_time));
     CSV = flash_storage.getBool("csv", true);
     R_LOG("FLASH", "Read: CSV " + String(CSV));
+    batch_time = flash_storage.getUInt("batch", 0);
+    R_LOG("FLASH", "Read: Batch " + String(batch_time));
+    payload_format = flash_storage.getUChar("payload", 0);
+    if(payload_format >= PAYLOAD_FORMATS) { payload_format = 0; }
+    R_LOG("FLASH", "Read: Payload format " + String(payload_format));
     use_sd = flash_storage.getBool("sd", false);
     R_LOG("FLASH", "Read: SD " + String(use_sd));
     gmtoffset_sec = flash_storage.getInt("gmt", -12600);
     R_LOG("FLASH", "Read: GMT " + String(gmtoffset_sec));
     daylightoffset_sec = flash_storage.getUInt("dst", 3600);
     R_LOG("FLASH", "Read: DST " + String(daylightoffset_sec));
+    sd_flush_time = flash_storage.getUInt("sdflush", 10000);
+    R_LOG("FLASH", "Read: SD flush " + String(sd_flush_time));
+    sd_format = flash_storage.getUChar("sdfmt", LOG_TEXT);
+    R_LOG("FLASH", "Read: SD format " + String(sd_format));
+    sd_segment_kb = flash_storage.getUInt("segkb", 1024);
+    R_LOG("FLASH", "Read: SD segment " + String(sd_segment_kb));
+    sd_budget_mb = flash_storage.getUInt("budmb", 64);
+    R_LOG("FLASH", "Read: SD budget " + String(sd_budget_mb));
+    agg_window = flash_storage.getUInt("aggwin", 0);
+    agg_raw = flash_storage.getBool("aggraw", false);
+    R_LOG("FLASH", "Read: Aggregate " + String(agg_window) + "s");
+    stats_time = flash_storage.getUInt("stats", 300);
+    stats_reset = flash_storage.getBool("statrst", false);
+    R_LOG("FLASH", "Read: Metrics " + String(stats_time) + "s");
 
     for(int x = 0; x < read_num; x++)
     {
-        uint8_t temp[8];
-        std::array<uint8_t, 8> temp_array;
+        uint8_t frame[MODBUS_MAX_FRAME];
         String msg_name = "msg" + String(x+1);
-        flash_storage.getBytes(msg_name.c_str(), &temp, sizeof(temp));
-        for(int y = 0; y < 8; y++)
+        size_t len = flash_storage.getBytesLength(msg_name.c_str());
+        if(len < 4 || len > sizeof(frame)) { continue; }
+        flash_storage.getBytes(msg_name.c_str(), frame, len);
+        uint32_t interval = flash_storage.getUInt(("ivl" + String(x+1)).c_str(), 0);
+        uint8_t priority = flash_storage.getUChar(("pri" + String(x+1)).c_str(), 0);
+        R_LOG("FLASH", "Read: MSG " + msg_name + " every " + String(interval) + "ms");
+        send_que.add(frame, len, interval, priority);
+        DECODE_DESC desc;
+        if(flash_storage.getBytes(("dec" + String(x+1)).c_str(), &desc, sizeof(desc)) == sizeof(desc))
         {
-            temp_array[y] = temp[y];
+            send_que[send_que.size()-1].decode = desc;
+        }
+        DEADBAND_DESC deadband;
+        if(flash_storage.getBytes(("db" + String(x+1)).c_str(), &deadband, sizeof(deadband)) == sizeof(deadband))
+        {
+            send_que[send_que.size()-1].deadband = deadband;
         }
-        R_LOG("FLASH", "Read: MSG " + msg_name);
-        send_que.push_back(temp_array);
     }
+    rs485_plan();
 
     /** 
      * Join WiFi and connect to MQTT 
@@ -111,77 +260,194 @@ void setup()
      */
     mqtt_lib.mqtt_setup();
     logger_lib.logger_setup();
+    outbox.outbox_setup(use_sd && card_found);
 
     /** Setup RS485 */
     R_LOG("RS485", "Starting bus " + String(baud_rate));
+    SERIAL_PORT_HARDWARE.setRxBufferSize(UART_RX_SIZE);
     RS485.begin(baud_rate);
     RS485.receive();
+
+    /** 
+     * Modbus RTU frames end after 3.5 characters of silence
+     * 11 bits per character, fixed at 1750us above 19200 baud
+     * 
+     */
+    if(baud_rate > 19200)
+    {
+        silence_time = 1750;
+    } else {
+        silence_time = (3.5 * 11 * 1000000) / baud_rate;
+    }
+    R_LOG("RS485", "Frame silence " + String(silence_time) + "us");
+    slave_latency.latency_setup(baud_rate);
+    flash_latency(true);
+
+    /** Watchdog, and what it saw before the last reset goes to SD now and MQTT once connected */
+    stalls.stall_setup();
+    if(stalls.sd_pending)
+    {
+        char text[512];
+        stalls.format_dump(text, sizeof(text));
+        R_LOG("STALL", text);
+        logger_lib.logger_note(STALL_FILE, text);
+        stalls.sd_pending = false;
+    }
+    stalls.stall_register(STALL_TASK_RS485, RS485_WDT_TIME);
+
+    /** loop() stays the RS485 task, network and SD move to the other core */
+    xTaskCreatePinnedToCore(net_task, "net", NET_TASK_STACK, nullptr, 1, &net_handle, NET_TASK_CORE);
 }
 
 /**
- * @brief Main loop
+ * @brief Main loop, the RS485 task
+ * Never waits on the network, readings go out through reading_ring
  * 
  */
 void loop() 
 {
-    /** Loop our MQTT lib */
-    mqtt_lib.mqtt_loop();
+    /** Iteration time, start to start */
+    static uint32_t loop_last;
+    uint32_t loop_now = micros();
+    if(loop_last != 0) { metrics.record(M_LOOP_US, loop_now - loop_last); }
+    loop_last = loop_now;
+    stalls.beat(STALL_TASK_RS485);
+
+    /** Config downlinks from the network task */
+    {
+        STALL_PROBE probe(STALL_CONFIG);
+        mqtt_lib.mqtt_config();
+    }
 
+    /** Drain everything the UART has */
     if(RS485.available())
     {
-        reply_que.push_back(RS485.read());
+        STALL_PROBE probe(STALL_RS485_RX);
+        while(RS485.available())
+        {
+            reply_ring.push(RS485.read());
+        }
+        rx_time = micros();
+    }
+
+    /** Step the RS485 master */
+    {
+        STALL_PROBE probe(STALL_RS485_STEP);
+        rs485_loop();
     }
 
-    static uint32_t last_time;
-    if ((micros() - last_time) >= delay_time && !busy)
+    /** Fire whatever polls are due, back to back */
+    if(rs485_state == RS485_IDLE)
     {
-        last_time = micros();
-        rs485_send();
+        STALL_PROBE probe(STALL_RS485_SEND);
+        int16_t txn = rs485_sched.next(millis());
+        /** Dead slaves only get the odd probe */
+        if(txn >= 0 && slave_health.allow(rs485_txns[txn].slave, millis())) { rs485_send(txn); }
+    }
+
+    static uint32_t last_save;
+    if((millis() - last_save) >= LATENCY_SAVE_TIME)
+    {
+        STALL_PROBE probe(STALL_FLASH);
+        last_save = millis();
+        flash_latency(false);
     }
 }
 
 /**
- * @brief Send messages to sensors
- * These messages are repeated every X
+ * @brief Network task
+ * MQTT, WiFi and SD, so a TLS handshake or a slow card
+ * never holds up bus timing
  * 
+ * @param param unused
  */
-void rs485_send()
+void net_task(void* param)
 {
-    busy = true;
-    size_t size = send_que.size();
-    if(size > 0) 
+    stalls.stall_register(STALL_TASK_NET, NET_WDT_TIME);
+    for(;;)
     {
-        R_LOG("RS485", "Sending RS485 message");
-        if(sensor_count != size)
+        stalls.beat(STALL_TASK_NET);
+        mqtt_lib.mqtt_loop();
+
+        READING* next;
+        while((next = reading_ring.front()) != nullptr)
         {
-            uint8_t temp_array[8];
-            for(int x = 0; x < 8; x++)
+            if(next->report)
             {
-                temp_array[x] = send_que[sensor_count][x];
+                STALL_PROBE probe(STALL_MQTT_PUBLISH);
+                mqtt_lib.mqtt_publish(*next);
             }
-            RS485.beginTransmission();
-            RS485.write(temp_array, 8);
-            RS485.endTransmission();
-            delay(250);
-            rs485_read(true);
-            sensor_count++;
-        } else {
-            sensor_count = 0;
-            uint8_t temp_array[8];
-            for(int x = 0; x < 8; x++)
             {
-                temp_array[x] = send_que[sensor_count][x];
+                STALL_PROBE probe(STALL_SD_WRITE);
+                logger_lib.write_sd(*next);
             }
-            RS485.beginTransmission();
-            RS485.write(temp_array, 8);
-            RS485.endTransmission();
-            delay(250);
-            rs485_read(true);
-            sensor_count++;
+            reading_ring.release();
+        }
+
+        STATUS_MSG status;
+        while(status_ring.pop(status))
+        {
+            STALL_PROBE probe(STALL_MQTT_PUBLISH);
+            String state = String(HEALTH::state_name(status.health.state)) + "," + String(status.health.timeouts) + "," + String(status.health.crc_errors);
+            mqtt_lib.mqtt_status(String(status.addr), state);
+        }
+
+        {
+            STALL_PROBE probe(STALL_SD_FLUSH);
+            logger_lib.logger_loop();
         }
+        vTaskDelay(1);
+    }
+}
+
+/**
+ * @brief Send messages to sensors
+ * These messages are repeated on their own schedule
+ * 
+ * @param txn Transaction index
+ */
+void rs485_send(uint8_t txn)
+{
+    if(txn < rs485_txns.size()) 
+    {
+        R_LOG("RS485", "Sending RS485 message");
+        rs485_begin(&rs485_frames[rs485_txns[txn].offset], rs485_txns[txn].len, true, txn);
+    }
+}
+
+/**
+ * @brief Rebuild bus transactions after send_que changes
+ * Neighbouring register reads on a slave share one frame.
+ * Every transaction is polled once straight away
+ * 
+ * @param renumbered Messages were added or removed, deadband and aggregate state is dropped
+ */
+void rs485_plan(bool renumbered)
+{
+    /** Reply in flight no longer maps to a transaction */
+    if(tx_txn >= 0)
+    {
+        tx_txn = -1;
+        tx_mqtt = false;
     }
-    busy = false;
-    if(onetime_retry) { send_onetime(onetime_msg); }
+    coalesce_build(send_que, rs485_txns, rs485_members, rs485_frames);
+    /** Message numbers may have moved, next readings report afresh */
+    if(renumbered)
+    {
+        reading_deadband.clear();
+        reading_aggregate.clear();
+    }
+
+    /** Messages without their own interval follow delay_time */
+    rs485_sched.clear();
+    uint32_t now = millis();
+    for(size_t x = 0; x < rs485_txns.size(); x++)
+    {
+        uint32_t interval = rs485_txns[x].interval;
+        if(interval == 0) { interval = delay_time / 1000; }
+        rs485_sched.add(x, interval, rs485_txns[x].priority, now);
+    }
+    R_LOG("RS485", String(send_que.size()) + " messages in " + String(rs485_txns.size()) + " transactions");
 }
 
 /**
@@ -189,96 +455,350 @@ void rs485_send()
  * Used for things like config settings
  * Nothing sent to logger or MQTT
  * 
- * @param value 
+ * @param value Frame including CRC
+ * @param len 
  */
-void send_onetime(uint8_t value[8])
+void send_onetime(const uint8_t* value, uint16_t len)
 {
-    if(!busy)
+    if(rs485_state == RS485_IDLE)
     {
         R_LOG("RS485", "Sending one time message");
-        RS485.beginTransmission();
-        RS485.write(value, 8);
-        RS485.endTransmission();
         onetime_retry = false;
-        delay(250);
-        rs485_read(false);
+        rs485_begin(value, len, false, -1);
     } else {
         R_LOG("RS485", "Busy, caching one time message");
-        for(int x = 0; x < 8; x++)
-        {
-            onetime_msg[x] = value[x];
-        }
+        if(value != onetime_msg) { memcpy(onetime_msg, value, len); }
+        onetime_len = len;
         onetime_retry = true;
     }
 }
 
 /**
- * @brief Read reply of sensors
- * If MQTT send is off, show raw data
+ * @brief Queue a frame for the RS485 master
+ * 
+ * @param value Frame to send, including CRC
+ * @param len 
+ * @param mqtt_send Publish the reply
+ * @param txn Transaction index, -1 for none
+ */
+void rs485_begin(const uint8_t* value, uint16_t len, bool mqtt_send, int16_t txn)
+{
+    if(value != tx_frame) { memcpy(tx_frame, value, len); }
+    tx_len = len;
+    tx_mqtt = mqtt_send;
+    tx_txn = txn;
+    rs485_state = RS485_TX;
+}
+
+/**
+ * @brief Step the RS485 master state machine
+ * IDLE -> TX -> WAIT_REPLY -> RX -> DONE/TIMEOUT -> IDLE
+ * Never blocks longer than one frame transmit
  * 
  */
-void rs485_read(bool mqtt_send)
+void rs485_loop()
 {
-    size_t que_size = reply_que.size();
-    if(que_size > 0)
+    switch(rs485_state)
     {
-        uint8_t addr = reply_que[0];
-        uint8_t num_bytes = reply_que[2];
-        std::vector<uint8_t> temp;
-        String sensor_data;
-        if(num_bytes < 2)
+        case RS485_IDLE:
+            if(onetime_retry) { send_onetime(onetime_msg, onetime_len); }
+        break;
+        case RS485_TX:
+            /** Wait for the bus to go quiet before talking */
+            if((micros() - rx_time) >= silence_time && !RS485.available())
+            {
+                reply_ring.clear();
+                frame_start = reply_ring.write_pos();
+                RS485.beginTransmission();
+                RS485.write(tx_frame, tx_len);
+                RS485.endTransmission();
+                tx_time = micros();
+                tx_timeout = slave_latency.timeout(tx_frame[0], modbus_reply_len(tx_frame));
+                rs485_state = RS485_WAIT_REPLY;
+            }
+        break;
+        case RS485_WAIT_REPLY:
+            if(reply_ring.write_pos() != frame_start)
+            {
+                first_rx_time = rx_time;
+                rs485_state = RS485_RX;
+            } else if((micros() - tx_time) >= tx_timeout) {
+                rs485_state = RS485_TIMEOUT;
+            }
+        break;
+        case RS485_RX:
+            /** Frame ends after 3.5 characters of silence */
+            if(!RS485.available() && (micros() - rx_time) >= silence_time)
+            {
+                rs485_state = RS485_DONE;
+            }
+        break;
+        case RS485_DONE:
         {
-            temp.push_back(reply_que[3]);
-        } else if (num_bytes == 2) {
-            temp.push_back(reply_que[3]);
-            temp.push_back(reply_que[4]);
-        } else if (num_bytes > 2) {
-            size_t size = num_bytes;
-            for(int x = 0; x < size/2; x++)
+            frame_end = reply_ring.write_pos();
+            uint32_t allocs = alloc_count();
+            bool ok = rs485_read(tx_mqtt);
+            read_allocs = alloc_count() - allocs;
+            if(read_allocs) { R_LOG("RS485", "Read path allocated " + String(read_allocs) + " times"); }
+            rs485_health(ok, true);
+            if(ok)
             {
-              temp.push_back(reply_que[3+(x+x)]);
-              temp.push_back(reply_que[4+(x+x)]);
+                slave_latency.sample(tx_frame[0], first_rx_time - tx_time);
+                metrics.slave_txn(tx_frame[0], rx_time - tx_time);
             }
+            reply_ring.release(frame_end);
+            rs485_state = RS485_IDLE;
         }
+        break;
+        case RS485_TIMEOUT:
+            R_LOG("RS485", "Timeout waiting for reply");
+            rs485_health(false, false);
+            slave_latency.expired(tx_frame[0]);
+            reply_ring.clear();
+            rs485_state = RS485_IDLE;
+        break;
+    }
+}
 
-        size_t data_size = temp.size();
-        if(data_size < 2)
-        {
-            sensor_data += String(temp[0]);
-        } else {
-            for(int y = 0; y < data_size/2; y++)
+/**
+ * @brief Track the slave of the frame in flight
+ * State changes are published
+ * 
+ * @param ok Slave answered with a good frame
+ * @param crc Failure was a bad frame rather than a timeout
+ */
+void rs485_health(bool ok, bool crc)
+{
+    uint8_t addr = tx_frame[0];
+    bool changed;
+    if(ok)
+    {
+        changed = slave_health.success(addr);
+    } else {
+        changed = slave_health.failure(addr, crc, millis());
+        if(crc) { metrics.slave_crc(addr); } else { metrics.slave_timeout(addr); }
+    }
+
+    if(changed)
+    {
+        STATUS_MSG status;
+        status.addr = addr;
+        status.health = slave_health.get(addr);
+        R_LOG("RS485", "Slave " + String(addr) + " " + String(HEALTH::state_name(status.health.state)));
+        status_ring.push(status);
+    }
+}
+
+/**
+ * @brief Read reply of sensors
+ * If MQTT send is off, show raw data
+ * 
+ * @return true if the reply was a good frame
+ */
+bool rs485_read(bool mqtt_send)
+{
+    static uint32_t last_overflow;
+    if(reply_ring.overflow != last_overflow)
+    {
+        last_overflow = reply_ring.overflow;
+        R_LOG("RS485", "Reply ring overflow " + String(last_overflow));
+    }
+
+    uint32_t frame_len = frame_end - frame_start;
+    if(frame_len < 5)
+    {
+        R_LOG("RS485", "Short reply dropped");
+        return false;
+    }
+
+    /** CRC is sent low byte first after the payload */
+    uint16_t crc = CRC16_INIT;
+    for(uint32_t x = frame_start; x != frame_end - 2; x++)
+    {
+        crc = crc16_update(crc, reply_ring.at(x));
+    }
+    uint16_t crc_rx = reply_ring.at(frame_end - 2) | (reply_ring.at(frame_end - 1) << 8);
+    if(crc != crc_rx)
+    {
+        crc_errors++;
+        R_LOG("RS485", "Bad CRC, dropped " + String(crc_errors));
+        return false;
+    }
+    frame_len -= 2;
+
+    uint8_t addr = reply_ring.at(frame_start);
+    uint8_t function = reply_ring.at(frame_start + 1);
+    if(addr != tx_frame[0] || (function & ~FC_EXCEPTION) != tx_frame[1])
+    {
+        R_LOG("RS485", "Reply does not match request");
+        return false;
+    }
+
+    /** Slave is alive, it just refused the request */
+    if(function & FC_EXCEPTION)
+    {
+        R_LOG("RS485", "Exception from " + String(addr) + ": " + modbus_exception(reply_ring.at(frame_start + 2)));
+        return true;
+    }
+
+    uint16_t quantity = (tx_frame[4] << 8) | tx_frame[5];
+    uint8_t num_bytes = reply_ring.at(frame_start + 2);
+    uint32_t data = frame_start + 3;
+    uint8_t msg = tx_txn >= 0 ? rs485_members[rs485_txns[tx_txn].member_first].entry : 0xFF;
+    reading.addr = addr;
+    switch(function)
+    {
+        case FC_READ_COILS:
+        case FC_READ_INPUTS:
+            if(num_bytes != (quantity + 7) / 8 || frame_len != 3U + num_bytes)
+            {
+                R_LOG("RS485", "Bad byte count");
+                return false;
+            }
+            reading.msg = msg;
+            rs485_decode_bits(data, quantity);
+            rs485_report(mqtt_send);
+        break;
+        case FC_READ_HOLDING:
+        case FC_READ_INPUT_REGS:
+            if(num_bytes != quantity * 2 || frame_len != 3U + num_bytes)
             {
-              uint8_t high_b = temp[y+y];
-              uint8_t low_b = temp[(y+y)+1];
-              uint16_t result = (high_b << 8) | low_b;
-              float resultf = result / 10.0;
-              if(y == (data_size/2)-1)
-              {
-                if(mqtt_send)
+                R_LOG("RS485", "Bad byte count");
+                return false;
+            }
+            if(tx_txn >= 0 && rs485_txns[tx_txn].is_read)
+            {
+                /** Fan a merged read back out to its messages */
+                RS485_TXN &txn = rs485_txns[tx_txn];
+                for(int x = 0; x < txn.member_num; x++)
                 {
-                    sensor_data += String(resultf);
-                } else {
-                    sensor_data += String(result);
+                    RS485_MEMBER &member = rs485_members[txn.member_first + x];
+                    rs485_decode(data + member.offset * 2, member.count, send_que[member.entry].decode, member.entry);
+                    rs485_report(mqtt_send);
                 }
-              } else {
-                if(mqtt_send)
+            } else if(tx_txn >= 0) {
+                rs485_decode(data, quantity, send_que[msg].decode, msg);
+                rs485_report(mqtt_send);
+            } else {
+                rs485_decode(data, quantity, DECODE_DEFAULT, msg);
+                rs485_report(mqtt_send);
+            }
+        break;
+        case FC_WRITE_COIL:
+        case FC_WRITE_REG:
+        case FC_WRITE_COILS:
+        case FC_WRITE_REGS:
+            /** Echo of address and value/quantity written */
+            if(frame_len != 6)
+            {
+                R_LOG("RS485", "Bad write reply");
+                return false;
+            }
+            rs485_decode(frame_start + 4, 1, DECODE_RAW, msg);
+            rs485_report(mqtt_send);
+        break;
+        default:
+            /** Unknown function, best effort byte count layout */
+            if(frame_len > 3)
+            {
+                if(num_bytes > frame_len - 3) { num_bytes = frame_len - 3; }
+                if(num_bytes < 2)
                 {
-                    sensor_data += String(resultf) + "+";
+                    reading.msg = msg;
+                    reading.type = REG_U16;
+                    reading.scale = 1;
+                    reading.offset = 0;
+                    reading.count = 1;
+                    reading.values[0] = reply_ring.at(data);
+                    reading.raw[0] = reply_ring.at(data);
                 } else {
-                    sensor_data += String(result) + ",";
+                    rs485_decode(data, num_bytes / 2, DECODE_DEFAULT, msg);
                 }
-              }
+                rs485_report(mqtt_send);
             }
-        }
-        /** Send MQTT here */
-        R_LOG("RS485", sensor_data);
-        if(mqtt_send)
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Decode registers from the reply ring into reading
+ * 
+ * @param data Ring offset of the first register
+ * @param regs Number of registers
+ * @param desc How the registers are decoded
+ * @param msg send_que index, 0xFF for one time messages
+ */
+void rs485_decode(uint32_t data, uint16_t regs, const DECODE_DESC &desc, uint8_t msg)
+{
+    if(regs > READING_MAX_VALUES) { regs = READING_MAX_VALUES; }
+    reading.msg = msg;
+    reading.type = desc.type;
+    reading.scale = desc.scale;
+    reading.offset = desc.offset;
+    reading.count = decode_block(RING_SRC{data}, regs, desc, reading.values, reading.raw);
+}
+
+/**
+ * @brief Decode coil/input bits from the reply ring into reading
+ * 
+ * @param data Ring offset of the first bit byte
+ * @param bits Number of bits
+ */
+void rs485_decode_bits(uint32_t data, uint16_t bits)
+{
+    if(bits > READING_MAX_VALUES) { bits = READING_MAX_VALUES; }
+    for(int y = 0; y < bits; y++)
+    {
+        /** LSB of the first byte is the first bit */
+        uint8_t bit = (reply_ring.at(data + y / 8) >> (y % 8)) & 1;
+        reading.values[y] = bit;
+        reading.raw[y] = bit;
+    }
+    reading.count = bits;
+    reading.type = REG_U16;
+    reading.scale = 1;
+    reading.offset = 0;
+}
+
+/**
+ * @brief Hand reading to MQTT and the logger
+ * Each sink formats it once into its own buffer
+ * 
+ * @param mqtt_send Off for one time messages, raw values are shown
+ */
+void rs485_report(bool mqtt_send)
+{
+    #if DEBUG
+    static char sensor_data[READING_TEXT_SIZE];
+    reading_format(reading, ",", !mqtt_send, sensor_data, sizeof(sensor_data));
+    R_LOG("RS485", sensor_data);
+    #endif
+    if(mqtt_send)
+    {
+        reading.seq = ++reading_seq;
+        reading.epoch = time(nullptr);
+        if(agg_window > 0)
         {
-            mqtt_lib.mqtt_publish(String(addr), sensor_data);
-            logger_lib.write_sd(sensor_data);
+            /** Only window summaries are published, samples go to SD if asked */
+            static READING summary;
+            agg_result_t result = reading_aggregate.add(reading, millis(), agg_window * 1000, summary);
+            if(result == AGG_SUMMARY)
+            {
+                summary.seq = ++reading_seq;
+                summary.epoch = reading.epoch;
+                summary.report = true;
+                if(!reading_ring.push(summary)) { R_LOG("RS485", "Reading queue full, dropped"); }
+            }
+            if(result != AGG_SKIP)
+            {
+                reading.report = false;
+                if(agg_raw && !reading_ring.push(reading)) { R_LOG("RS485", "Reading queue full, dropped"); }
+                return;
+            }
         }
-
-        reply_que.clear();
+        reading.report = reading.msg >= send_que.size() || reading_deadband.report(reading, send_que[reading.msg].deadband, millis());
+        if(!reading_ring.push(reading)) { R_LOG("RS485", "Reading queue full, dropped"); }
     }
 }
 
@@ -310,6 +830,20 @@ void flash_32u(const char* key, uint32_t value, bool restart)
     if(restart) { }
 }
 
+/**
+ * @brief Save key:value data to flash
+ * 
+ * @param key char
+ * @param value uint8_t
+ * @param restart unused
+ */
+void flash_8u(const char* key, uint8_t value, bool restart)
+{
+    flash_storage.putUChar(key, value);
+    R_LOG("FLASH", "Write: " + String(key) + "/" + String(value));
+    if(restart) { }
+}
+
 /**
  * @brief Save key:value data to flash
  * 
@@ -342,16 +876,78 @@ void flash_bool(const char* key, bool value, bool restart)
  * @brief Save key:value data to flash
  * 
  * @param key char
- * @param value bool
+ * @param value bytes
+ * @param len
  * @param restart unused
  */
-void flash_bytes(const char* key, uint8_t value[8], bool restart)
+void flash_bytes(const char* key, const uint8_t* value, size_t len, bool restart)
 {
-    flash_storage.putBytes(key, value, 8);
+    flash_storage.putBytes(key, value, len);
     R_LOG("FLASH", "Write: " + String(key));
     if(restart) { }
 }
 
+/**
+ * @brief Save send_que to flash
+ * msgN holds the frame, ivlN/priN its schedule,
+ * rewritten in full so deletes leave no holes
+ * 
+ */
+void flash_msgs()
+{
+    uint8_t old_num = flash_storage.getUInt("rnum", 0);
+    read_num = send_que.size();
+    for(int x = 0; x < read_num; x++)
+    {
+        String num = String(x+1);
+        flash_bytes(("msg" + num).c_str(), send_que.frame(x), send_que[x].len, false);
+        flash_storage.putUInt(("ivl" + num).c_str(), send_que[x].interval);
+        flash_storage.putUChar(("pri" + num).c_str(), send_que[x].priority);
+        flash_storage.putBytes(("dec" + num).c_str(), &send_que[x].decode, sizeof(DECODE_DESC));
+        flash_storage.putBytes(("db" + num).c_str(), &send_que[x].deadband, sizeof(DEADBAND_DESC));
+    }
+    for(int x = read_num; x < old_num; x++)
+    {
+        String num = String(x+1);
+        delete_key("msg" + num);
+        delete_key("ivl" + num);
+        delete_key("pri" + num);
+        delete_key("dec" + num);
+        delete_key("db" + num);
+    }
+    flash_32u("rnum", read_num, false);
+}
+
+/**
+ * @brief Load or save learned reply latency
+ * Kept as latN per slave address on the bus, only
+ * slaves that learned something new get written
+ * 
+ * @param load Read from flash rather than write
+ */
+void flash_latency(bool load)
+{
+    for(size_t x = 0; x < rs485_txns.size(); x++)
+    {
+        uint8_t addr = rs485_txns[x].slave;
+        String key = "lat" + String(addr);
+        SLAVE_LATENCY learned;
+        if(load)
+        {
+            if(flash_storage.getBytes(key.c_str(), &learned, sizeof(learned)) == sizeof(learned))
+            {
+                slave_latency.set(addr, learned);
+                R_LOG("FLASH", "Read: " + key + " " + String(learned.first) + "us");
+            }
+        } else if(slave_latency.dirty(addr)) {
+            learned = slave_latency.get(addr);
+            flash_storage.putBytes(key.c_str(), &learned, sizeof(learned));
+            slave_latency.saved(addr);
+            R_LOG("FLASH", "Write: " + key + " " + String(learned.first) + "us");
+        }
+    }
+}
+
 /**
  * @brief Delete key saved to flash
  * 
@@ -371,7 +967,25 @@ void delete_key(String key)
 void R_LOG(String chan, String data)
 {
     #if DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
     String disp = "["+chan+"] " + data;
     Serial.println(disp);
     #endif
 }
+
+/**
+ * @brief Debug output text without touching the heap
+ * 
+ * @param chan Output channel
+ * @param data Text to output
+ */
+void R_LOG(const char* chan, const char* data)
+{
+    #if DEBUG
+    STALL_PROBE probe(STALL_SERIAL);
+    Serial.print("[");
+    Serial.print(chan);
+    Serial.print("] ");
+    Serial.println(data);
+    #endif
+}
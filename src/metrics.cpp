@@ -0,0 +1,147 @@
+/**
+ * @file metrics.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-16
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <metrics.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Registry shared by both tasks */
+METRICS metrics;
+
+static const char* counter_names[M_COUNTERS] = {"pub", "pubfail", "wifi", "mqtt", "sdfail"};
+static const char* gauge_names[M_GAUGES] = {"heap", "block", "sdkb", "sdrawkb", "sdroll", "sdprune"};
+static const char* hist_names[M_HISTS] = {"loop", "pubus", "sdus"};
+
+METRICS::METRICS()
+{
+    memset(slot_of, METRIC_NO_SLOT, sizeof(slot_of));
+}
+
+/**
+ * @brief Give a new address a slot
+ * 
+ * @param addr 
+ * @return uint8_t Slot, the last one is shared once they run out
+ */
+uint8_t METRICS::slot_new(uint8_t addr)
+{
+    uint8_t used = slots_used.load(std::memory_order_relaxed);
+    if(used == METRIC_SLAVES)
+    {
+        /** Shared slot is reported as address 0 */
+        slaves[METRIC_SLAVES - 1].addr = 0;
+        slot_of[addr] = METRIC_SLAVES - 1;
+        return METRIC_SLAVES - 1;
+    }
+    slaves[used].addr = addr;
+    slot_of[addr] = used;
+    slots_used.store(used + 1, std::memory_order_release);
+    return used;
+}
+
+/**
+ * @brief Value at or below which pct percent of the samples fall
+ * Upper edge of the bucket, capped at the largest sample seen
+ * 
+ * @param buckets METRIC_BUCKETS counts
+ * @param max Largest sample
+ * @param pct 
+ * @return uint32_t 
+ */
+uint32_t METRICS::percentile(const uint32_t* buckets, uint32_t max, uint8_t pct)
+{
+    uint64_t total = 0;
+    for(uint8_t x = 0; x < METRIC_BUCKETS; x++) { total += buckets[x]; }
+    if(total == 0) { return 0; }
+    uint64_t want = (total * pct + 99) / 100;
+    uint64_t seen = 0;
+    for(uint8_t x = 0; x < METRIC_BUCKETS; x++)
+    {
+        seen += buckets[x];
+        if(seen >= want)
+        {
+            uint32_t edge = (1UL << x) - 1;
+            return edge < max ? edge : max;
+        }
+    }
+    return max;
+}
+
+/**
+ * @brief Read a cell, zeroing it if asked
+ * 
+ */
+static uint32_t take(std::atomic<uint32_t> &cell, bool reset)
+{
+    return reset ? cell.exchange(0, std::memory_order_relaxed) : cell.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Histogram as count/p50/p99/max
+ * 
+ */
+static size_t format_hist(char* buf, size_t size, METRIC_HIST &hist, bool reset)
+{
+    if(size == 0) { return 0; }
+    uint32_t buckets[METRIC_BUCKETS];
+    uint32_t count = 0;
+    for(uint8_t x = 0; x < METRIC_BUCKETS; x++)
+    {
+        buckets[x] = take(hist.buckets[x], reset);
+        count += buckets[x];
+    }
+    uint32_t max = take(hist.max, reset);
+    int len = snprintf(buf, size, "%u/%u/%u/%u", (unsigned)count, (unsigned)METRICS::percentile(buckets, max, 50),
+        (unsigned)METRICS::percentile(buckets, max, 99), (unsigned)max);
+    return len < 0 ? 0 : ((size_t)len < size ? len : size - 1);
+}
+
+/**
+ * @brief One line of name=value pairs
+ * Counters and gauges as numbers, histograms as count/p50/p99/max in us,
+ * slaves as s<addr>=replies/timeouts/crc_errors/count/p50/p99/max
+ * 
+ * @param buf 
+ * @param size 
+ * @param reset Zero counters and histograms once read
+ * @return size_t Length written
+ */
+size_t METRICS::format(char* buf, size_t size, bool reset)
+{
+    size_t len = 0;
+    auto room = [&]() { return len < size ? size - len : 0; };
+    auto put = [&](int n) { if(n > 0) { len += n; } if(len >= size) { len = size - 1; } };
+
+    if(size == 0) { return 0; }
+    buf[0] = 0;
+    for(uint8_t x = 0; x < M_COUNTERS; x++)
+    {
+        put(snprintf(buf + len, room(), "%s%s=%u", len ? "," : "", counter_names[x], (unsigned)take(counters[x], reset)));
+    }
+    for(uint8_t x = 0; x < M_GAUGES; x++)
+    {
+        put(snprintf(buf + len, room(), ",%s=%u", gauge_names[x], (unsigned)gauges[x].load(std::memory_order_relaxed)));
+    }
+    for(uint8_t x = 0; x < M_HISTS; x++)
+    {
+        put(snprintf(buf + len, room(), ",%s=", hist_names[x]));
+        len += format_hist(buf + len, room(), hists[x], reset);
+    }
+    uint8_t used = slots_used.load(std::memory_order_acquire);
+    for(uint8_t x = 0; x < used; x++)
+    {
+        METRIC_SLAVE &slave = slaves[x];
+        put(snprintf(buf + len, room(), ",s%u=%u/%u/%u/", (unsigned)slave.addr, (unsigned)take(slave.txns, reset),
+            (unsigned)take(slave.timeouts, reset), (unsigned)take(slave.crc_errors, reset)));
+        len += format_hist(buf + len, room(), slave.latency, reset);
+    }
+    return len;
+}
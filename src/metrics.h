@@ -0,0 +1,143 @@
+/**
+ * @file metrics.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-16
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __metrics_H__
+#define __metrics_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/** Histogram buckets, bucket n holds values below 2^n, the last takes the rest */
+#define METRIC_BUCKETS 24
+/** Slaves with metrics of their own, the rest share the last slot */
+#define METRIC_SLAVES 16
+/** No slot yet */
+#define METRIC_NO_SLOT 0xFF
+
+/** Counters */
+enum metric_counter_t
+{
+    M_PUB_OK,
+    M_PUB_FAIL,
+    M_WIFI_CONNECT,
+    M_MQTT_CONNECT,
+    M_SD_FAIL,
+    M_COUNTERS
+};
+
+/** Gauges, last value set */
+enum metric_gauge_t
+{
+    M_HEAP_FREE,
+    M_HEAP_BLOCK,
+    /** SD log totals from LOGGER_STATS */
+    M_SD_KB,
+    M_SD_RAW_KB,
+    M_SD_ROLLED,
+    M_SD_PRUNED,
+    M_GAUGES
+};
+
+/** Histograms, us */
+enum metric_hist_t
+{
+    M_LOOP_US,
+    M_PUB_US,
+    M_SD_US,
+    M_HISTS
+};
+
+/**
+ * @brief Log2 bucketed histogram
+ * 
+ */
+struct METRIC_HIST
+{
+    std::atomic<uint32_t> buckets[METRIC_BUCKETS];
+    std::atomic<uint32_t> max;
+};
+
+/**
+ * @brief Transactions of one slave
+ * 
+ */
+struct METRIC_SLAVE
+{
+    uint8_t addr;
+    /** Good replies */
+    std::atomic<uint32_t> txns;
+    std::atomic<uint32_t> timeouts;
+    std::atomic<uint32_t> crc_errors;
+    /** Request sent to last reply byte */
+    METRIC_HIST latency;
+};
+
+/**
+ * @brief Fixed size metrics registry
+ * Recording is a relaxed atomic add or two and a compare exchange for
+ * the max, so counters and histograms take records from any task.
+ * Slaves are handed slots on first use and stay RS485 task only.
+ * Formatting reads while they are written
+ * 
+ */
+class METRICS
+{
+    public:
+    METRICS();
+    void count(metric_counter_t id, uint32_t n = 1) { counters[id].fetch_add(n, std::memory_order_relaxed); }
+    void gauge(metric_gauge_t id, uint32_t value) { gauges[id].store(value, std::memory_order_relaxed); }
+    void record(metric_hist_t id, uint32_t value) { hist_add(hists[id], value); }
+
+    /** Slave metrics, RS485 task only */
+    void slave_txn(uint8_t addr, uint32_t us)
+    {
+        METRIC_SLAVE &slave = slave_get(addr);
+        slave.txns.fetch_add(1, std::memory_order_relaxed);
+        hist_add(slave.latency, us);
+    }
+    void slave_timeout(uint8_t addr) { slave_get(addr).timeouts.fetch_add(1, std::memory_order_relaxed); }
+    void slave_crc(uint8_t addr) { slave_get(addr).crc_errors.fetch_add(1, std::memory_order_relaxed); }
+
+    size_t format(char* buf, size_t size, bool reset);
+    static uint32_t percentile(const uint32_t* buckets, uint32_t max, uint8_t pct);
+
+    private:
+    static void hist_add(METRIC_HIST &hist, uint32_t value)
+    {
+        uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+        if(bucket >= METRIC_BUCKETS) { bucket = METRIC_BUCKETS - 1; }
+        hist.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        /** Another task may raise it in between, only ever move it up */
+        uint32_t max = hist.max.load(std::memory_order_relaxed);
+        while(value > max && !hist.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) { }
+    }
+    METRIC_SLAVE& slave_get(uint8_t addr)
+    {
+        uint8_t slot = slot_of[addr];
+        if(slot == METRIC_NO_SLOT) { slot = slot_new(addr); }
+        return slaves[slot];
+    }
+    uint8_t slot_new(uint8_t addr);
+
+    std::atomic<uint32_t> counters[M_COUNTERS] = {};
+    std::atomic<uint32_t> gauges[M_GAUGES] = {};
+    METRIC_HIST hists[M_HISTS] = {};
+    METRIC_SLAVE slaves[METRIC_SLAVES] = {};
+    /** Slots handed out, published to the reader with release */
+    std::atomic<uint8_t> slots_used{0};
+    /** Slot of each address, METRIC_NO_SLOT until first seen */
+    uint8_t slot_of[256];
+};
+
+extern METRICS metrics;
+
+#endif
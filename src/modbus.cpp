@@ -0,0 +1,118 @@
+/**
+ * @file modbus.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <modbus.h>
+#include <crc16.h>
+
+/**
+ * @brief Length a request should have, without CRC
+ * Unknown function codes are taken as they are
+ * 
+ * @param frame Request without CRC
+ * @param len Bytes available
+ * @return uint16_t Expected length, 0 if malformed
+ */
+uint16_t modbus_request_len(const uint8_t* frame, uint16_t len)
+{
+    if(len < 2) { return 0; }
+    switch(frame[1])
+    {
+        case FC_READ_COILS:
+        case FC_READ_INPUTS:
+        case FC_READ_HOLDING:
+        case FC_READ_INPUT_REGS:
+        case FC_WRITE_COIL:
+        case FC_WRITE_REG:
+            return 6;
+        case FC_WRITE_COILS:
+        case FC_WRITE_REGS:
+        {
+            /** addr, fc, start, quantity, byte count, data */
+            if(len < 7) { return 0; }
+            uint16_t quantity = (frame[4] << 8) | frame[5];
+            uint16_t bytes = frame[1] == FC_WRITE_REGS ? quantity * 2 : (quantity + 7) / 8;
+            if(frame[6] != bytes || 7 + bytes > MODBUS_MAX_FRAME - 2) { return 0; }
+            return 7 + bytes;
+        }
+        default:
+            return len;
+    }
+}
+
+/**
+ * @brief Length a good reply to a request will have, with CRC
+ * 
+ * @param frame Request
+ * @return uint16_t 
+ */
+uint16_t modbus_reply_len(const uint8_t* frame)
+{
+    uint16_t quantity = (frame[4] << 8) | frame[5];
+    switch(frame[1])
+    {
+        case FC_READ_COILS:
+        case FC_READ_INPUTS:
+            return 5 + (quantity + 7) / 8;
+        case FC_READ_HOLDING:
+        case FC_READ_INPUT_REGS:
+            return 5 + quantity * 2;
+        default:
+            return 8;
+    }
+}
+
+/**
+ * @brief Append the CRC
+ * 
+ * @param frame Needs len + 2 bytes of room
+ * @param len Bytes without CRC
+ * @return uint16_t Length with CRC
+ */
+uint16_t modbus_add_crc(uint8_t* frame, uint16_t len)
+{
+    uint16_t crc = crc16(frame, len);
+    frame[len] = crc & 0xFF;
+    frame[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+/**
+ * @brief Do the last two bytes hold the CRC of the rest
+ * 
+ * @param frame 
+ * @param len Bytes with CRC
+ * @return true 
+ */
+bool modbus_check_crc(const uint8_t* frame, uint16_t len)
+{
+    if(len < 4) { return false; }
+    return crc16(frame, len - 2) == (frame[len - 2] | (frame[len - 1] << 8));
+}
+
+/**
+ * @brief Name of an exception code
+ * 
+ * @param code 
+ * @return const char* 
+ */
+const char* modbus_exception(uint8_t code)
+{
+    switch(code)
+    {
+        case 0x01: return "illegal function";
+        case 0x02: return "illegal address";
+        case 0x03: return "illegal value";
+        case 0x04: return "device failure";
+        case 0x05: return "acknowledge";
+        case 0x06: return "device busy";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,39 @@
+/**
+ * @file modbus.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __modbus_H__
+#define __modbus_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Longest RTU frame including address and CRC */
+#define MODBUS_MAX_FRAME 256
+
+/** Supported function codes */
+#define FC_READ_COILS 0x01
+#define FC_READ_INPUTS 0x02
+#define FC_READ_HOLDING 0x03
+#define FC_READ_INPUT_REGS 0x04
+#define FC_WRITE_COIL 0x05
+#define FC_WRITE_REG 0x06
+#define FC_WRITE_COILS 0x0F
+#define FC_WRITE_REGS 0x10
+/** Set on the function code of an exception reply */
+#define FC_EXCEPTION 0x80
+
+uint16_t modbus_request_len(const uint8_t* frame, uint16_t len);
+uint16_t modbus_reply_len(const uint8_t* frame);
+uint16_t modbus_add_crc(uint8_t* frame, uint16_t len);
+bool modbus_check_crc(const uint8_t* frame, uint16_t len);
+const char* modbus_exception(uint8_t code);
+
+#endif
@@ -0,0 +1,290 @@
+/**
+ * @file outbox.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-22
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <outbox.h>
+#include <string.h>
+
+/**
+ * @brief Pick up a spool left by the last boot
+ * 
+ * @param spool_ok SD card is usable
+ */
+void OUTBOX::outbox_setup(bool spool_ok)
+{
+    use_spool = spool_ok;
+    if(!use_spool || !SD.exists(OUTBOX_SPOOL)) { return; }
+
+    spool = SD.open(OUTBOX_SPOOL, "r+");
+    OUTBOX_SPOOL_HEADER header;
+    if(!spool || spool.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != OUTBOX_SPOOL_MAGIC)
+    {
+        spool.close();
+        SD.remove(OUTBOX_SPOOL);
+        return;
+    }
+
+    /** Count what is left, a torn last entry is cut off */
+    spool_read = header.read;
+    spool_end = header.read;
+    uint32_t size = spool.size();
+    OUTBOX_ENTRY entry;
+    while(spool_end + sizeof(entry) <= size)
+    {
+        spool.seek(spool_end);
+        if(spool.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry)) { break; }
+        uint32_t len = OUTBOX_ENTRY_LEN(entry.count);
+        if(spool_end + len > size) { break; }
+        spool_end += len;
+        spool_entries++;
+    }
+    if(spool_entries == 0)
+    {
+        spool.close();
+        SD.remove(OUTBOX_SPOOL);
+    }
+}
+
+/**
+ * @brief Queue a reading
+ * 
+ * @param reading 
+ * @return false if it had to be dropped
+ */
+bool OUTBOX::push(const READING &reading)
+{
+    OUTBOX_ENTRY entry;
+    entry.seq = reading.seq;
+    entry.epoch = reading.epoch;
+    entry.addr = reading.addr;
+    entry.msg = reading.msg;
+    entry.type = reading.type;
+    entry.count = reading.count;
+    entry.scale = reading.scale;
+    entry.offset = reading.offset;
+    size_t len = OUTBOX_ENTRY_LEN(entry.count);
+
+    while(ram.capacity() - ram.size() < len)
+    {
+        if(!spill())
+        {
+            if(use_spool)
+            {
+                /** Spool is full, keep the older backlog */
+                counts.dropped++;
+                return false;
+            }
+            drop_oldest();
+        }
+    }
+
+    const uint8_t* bytes = (const uint8_t*)&entry;
+    for(size_t x = 0; x < sizeof(entry); x++) { ram.push(bytes[x]); }
+    bytes = (const uint8_t*)reading.values;
+    for(size_t x = 0; x < entry.count * sizeof(float); x++) { ram.push(bytes[x]); }
+    bytes = (const uint8_t*)reading.raw;
+    for(size_t x = 0; x < entry.count * sizeof(int32_t); x++) { ram.push(bytes[x]); }
+    ram_entries++;
+    counts.queued++;
+    return true;
+}
+
+/**
+ * @brief Oldest queued reading
+ * Everything but report is filled
+ * 
+ * @param reading 
+ * Spooled entries that can not be read back are dropped, so one bad
+ * record never holds up the rest of the backlog
+ * 
+ * @return false if the queue is empty
+ */
+bool OUTBOX::peek(READING &reading)
+{
+    OUTBOX_ENTRY entry;
+    bool spooled = false;
+    while(spool_entries > 0 && !spooled)
+    {
+        spool.seek(spool_read);
+        if(spool.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry) || spool_read + OUTBOX_ENTRY_LEN(entry.count) > spool_end)
+        {
+            /** No length to step over, nothing after it can be trusted */
+            spool_drop();
+            break;
+        }
+        spooled = spool.read((uint8_t*)reading.values, entry.count * sizeof(float)) == (int)(entry.count * sizeof(float)) &&
+            spool.read((uint8_t*)reading.raw, entry.count * sizeof(int32_t)) == (int)(entry.count * sizeof(int32_t));
+        if(!spooled)
+        {
+            counts.dropped++;
+            spool_advance(OUTBOX_ENTRY_LEN(entry.count));
+        }
+    }
+    if(!spooled)
+    {
+        if(ram_entries == 0) { return false; }
+        uint32_t offset = ram.read_pos() + ram_read(ram.read_pos(), entry);
+        uint8_t* bytes = (uint8_t*)reading.values;
+        for(size_t x = 0; x < entry.count * sizeof(float); x++) { bytes[x] = ram.at(offset + x); }
+        offset += entry.count * sizeof(float);
+        bytes = (uint8_t*)reading.raw;
+        for(size_t x = 0; x < entry.count * sizeof(int32_t); x++) { bytes[x] = ram.at(offset + x); }
+    }
+    reading.seq = entry.seq;
+    reading.epoch = entry.epoch;
+    reading.addr = entry.addr;
+    reading.msg = entry.msg;
+    reading.type = entry.type;
+    reading.count = entry.count;
+    reading.scale = entry.scale;
+    reading.offset = entry.offset;
+    reading.report = true;
+    peek_len = OUTBOX_ENTRY_LEN(entry.count);
+    return true;
+}
+
+/**
+ * @brief Drop the reading peek() handed out, once it is sent
+ * 
+ */
+void OUTBOX::pop()
+{
+    if(peek_len == 0) { return; }
+    if(spool_entries > 0)
+    {
+        spool_advance(peek_len);
+    } else {
+        ram.release(ram.read_pos() + peek_len);
+        ram_entries--;
+    }
+    peek_len = 0;
+    counts.sent++;
+}
+
+/**
+ * @brief Step past the oldest spooled entry
+ * 
+ * @param len Entry length
+ */
+void OUTBOX::spool_advance(uint32_t len)
+{
+    spool_read += len;
+    spool_entries--;
+    if(spool_entries == 0)
+    {
+        spool_drop();
+    } else if(spool_entries % OUTBOX_SPOOL_SYNC == 0) {
+        spool_sync();
+    }
+}
+
+/**
+ * @brief Give up on what is left in the spool and remove it
+ * 
+ */
+void OUTBOX::spool_drop()
+{
+    counts.dropped += spool_entries;
+    spool_entries = 0;
+    spool.close();
+    SD.remove(OUTBOX_SPOOL);
+    spool_read = 0;
+    spool_end = 0;
+}
+
+/**
+ * @brief Move the whole RAM queue to the end of the spool
+ * 
+ * @return false if there is no room on the card for it
+ */
+bool OUTBOX::spill()
+{
+    if(!use_spool || ram_entries == 0 || spool_end + ram.size() > OUTBOX_SPOOL_MAX) { return false; }
+    if(!spool)
+    {
+        spool = SD.open(OUTBOX_SPOOL, "w+");
+        if(!spool)
+        {
+            use_spool = false;
+            return false;
+        }
+        spool_read = sizeof(OUTBOX_SPOOL_HEADER);
+        spool_end = spool_read;
+        spool_sync();
+    }
+
+    uint8_t chunk[256];
+    uint32_t offset = ram.read_pos();
+    size_t left = ram.size();
+    spool.seek(spool_end);
+    while(left > 0)
+    {
+        size_t len = left < sizeof(chunk) ? left : sizeof(chunk);
+        for(size_t x = 0; x < len; x++) { chunk[x] = ram.at(offset + x); }
+        if(spool.write(chunk, len) != len)
+        {
+            /** Card gone, fall back to RAM only */
+            use_spool = false;
+            return false;
+        }
+        offset += len;
+        left -= len;
+    }
+    spool.flush();
+
+    spool_end += ram.size();
+    spool_entries += ram_entries;
+    counts.spooled += ram_entries;
+    ram.clear();
+    ram_entries = 0;
+    peek_len = 0;
+    return true;
+}
+
+/**
+ * @brief Save the spool read offset
+ * A reboot replays at most OUTBOX_SPOOL_SYNC readings twice
+ * 
+ */
+void OUTBOX::spool_sync()
+{
+    OUTBOX_SPOOL_HEADER header;
+    header.magic = OUTBOX_SPOOL_MAGIC;
+    header.read = spool_read;
+    spool.seek(0);
+    spool.write((const uint8_t*)&header, sizeof(header));
+    spool.flush();
+}
+
+/**
+ * @brief Make room in RAM when there is no spool
+ * 
+ */
+void OUTBOX::drop_oldest()
+{
+    OUTBOX_ENTRY entry;
+    ram_read(ram.read_pos(), entry);
+    ram.release(ram.read_pos() + OUTBOX_ENTRY_LEN(entry.count));
+    ram_entries--;
+    peek_len = 0;
+    counts.dropped++;
+}
+
+/**
+ * @brief Copy an entry header out of the ring
+ * 
+ * @return size_t Header length
+ */
+size_t OUTBOX::ram_read(uint32_t offset, OUTBOX_ENTRY &entry)
+{
+    uint8_t* bytes = (uint8_t*)&entry;
+    for(size_t x = 0; x < sizeof(entry); x++) { bytes[x] = ram.at(offset + x); }
+    return sizeof(entry);
+}
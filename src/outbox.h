@@ -0,0 +1,118 @@
+/**
+ * @file outbox.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-22
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __outbox_H__
+#define __outbox_H__
+
+#include <Arduino.h>
+#include <SD.h>
+#include <reading.h>
+#include <ring_buffer.h>
+
+/** RAM queue, power of two */
+#define OUTBOX_RAM_SIZE 16384
+/** SD spool file */
+#define OUTBOX_SPOOL "/spool.bin"
+#define OUTBOX_SPOOL_MAGIC 0x324C5053
+/** Most the spool may grow to */
+#define OUTBOX_SPOOL_MAX 4194304
+/** Backlog readings sent per batch */
+#define OUTBOX_BATCH 10
+/** Time between backlog batches, ms */
+#define OUTBOX_BATCH_TIME 1000
+/** How often replay progress is published, ms */
+#define OUTBOX_REPORT_TIME 60000
+/** Spool read offset is saved every this many entries */
+#define OUTBOX_SPOOL_SYNC 16
+
+/**
+ * @brief Queued reading header
+ * Followed by count float values, then count raw values
+ * 
+ */
+struct OUTBOX_ENTRY
+{
+    uint32_t seq;
+    uint32_t epoch;
+    uint8_t addr;
+    uint8_t msg;
+    uint8_t type;
+    uint8_t count;
+    float scale;
+    float offset;
+};
+
+/** Bytes an entry takes in the ring or spool */
+#define OUTBOX_ENTRY_LEN(count) (sizeof(OUTBOX_ENTRY) + (count) * (sizeof(float) + sizeof(int32_t)))
+
+/**
+ * @brief Spool file header
+ * 
+ */
+struct OUTBOX_SPOOL_HEADER
+{
+    uint32_t magic;
+    /** Offset of the oldest entry not yet sent */
+    uint32_t read;
+};
+
+/**
+ * @brief Queue stats
+ * 
+ */
+struct OUTBOX_STATS
+{
+    uint32_t queued;
+    uint32_t spooled;
+    uint32_t sent;
+    /** Lost to a full queue */
+    uint32_t dropped;
+};
+
+/**
+ * @brief Readings waiting for the broker
+ * A RAM ring that moves to an SD spool file whenever it fills.
+ * Everything in the spool is older than everything in RAM,
+ * so peek() always hands back the oldest reading.
+ * 
+ */
+class OUTBOX
+{
+    public:
+    void outbox_setup(bool spool_ok);
+    bool push(const READING &reading);
+    bool peek(READING &reading);
+    void pop();
+    uint32_t depth() const { return ram_entries + spool_entries; }
+    uint32_t spool_depth() const { return spool_entries; }
+    const OUTBOX_STATS& stats() const { return counts; }
+
+    private:
+    bool spill();
+    void spool_sync();
+    void spool_advance(uint32_t len);
+    void spool_drop();
+    void drop_oldest();
+    size_t ram_read(uint32_t offset, OUTBOX_ENTRY &entry);
+
+    RING_BUFFER<OUTBOX_RAM_SIZE> ram;
+    uint32_t ram_entries = 0;
+    bool use_spool = false;
+    File spool;
+    uint32_t spool_entries = 0;
+    uint32_t spool_read = 0;
+    uint32_t spool_end = 0;
+    /** Length of the entry peek() handed out */
+    uint32_t peek_len = 0;
+    OUTBOX_STATS counts = {};
+};
+
+#endif
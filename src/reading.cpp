@@ -0,0 +1,114 @@
+/**
+ * @file reading.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <reading.h>
+#include <string.h>
+
+/**
+ * @brief Write an unsigned number
+ * 
+ * @param buf Needs 20 bytes
+ * @param value 
+ * @return size_t Characters written
+ */
+size_t format_uint(char* buf, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+    do
+    {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while(value);
+    for(size_t x = 0; x < len; x++)
+    {
+        buf[x] = digits[len - 1 - x];
+    }
+    return len;
+}
+
+/**
+ * @brief Write an integer
+ * 
+ * @param buf Needs 12 bytes
+ * @param value 
+ * @return size_t Characters written, not terminated
+ */
+size_t format_int(char* buf, int32_t value)
+{
+    if(value < 0)
+    {
+        buf[0] = '-';
+        return 1 + format_uint(buf + 1, -(int64_t)value);
+    }
+    return format_uint(buf, value);
+}
+
+/**
+ * @brief Write a float with two decimals, as String(float) does
+ * No printf, no heap
+ * 
+ * @param buf Needs 14 bytes
+ * @param value 
+ * @return size_t Characters written, not terminated
+ */
+size_t format_float(char* buf, float value)
+{
+    if(value != value) { memcpy(buf, "nan", 3); return 3; }
+    if(value > 4294967040.0f) { memcpy(buf, "ovf", 3); return 3; }
+    if(value < -4294967040.0f) { memcpy(buf, "-ovf", 4); return 4; }
+
+    size_t len = 0;
+    double scaled = value;
+    if(scaled < 0)
+    {
+        scaled = -scaled;
+        buf[len++] = '-';
+    }
+    uint64_t hundredths = (uint64_t)(scaled * 100.0 + 0.5);
+    len += format_uint(buf + len, hundredths / 100);
+    buf[len++] = '.';
+    buf[len++] = '0' + (hundredths / 10) % 10;
+    buf[len++] = '0' + hundredths % 10;
+    return len;
+}
+
+/**
+ * @brief Format a reading once for a sink
+ * 
+ * @param reading 
+ * @param sep Between values, up to READING_SEP_MAX long
+ * @param raw Raw integers rather than scaled values
+ * @param buf Caller's buffer, READING_TEXT_SIZE fits every value, trailing values that do not fit are left out
+ * @param size 
+ * @return size_t Length, buf is always terminated
+ */
+size_t reading_format(const READING &reading, const char* sep, bool raw, char* buf, size_t size)
+{
+    size_t sep_len = strlen(sep);
+    size_t len = 0;
+    char value[16];
+    for(uint16_t x = 0; x < reading.count; x++)
+    {
+        size_t value_len = raw ? format_int(value, reading.raw[x]) : format_float(value, reading.values[x]);
+        size_t need = value_len + (x ? sep_len : 0);
+        if(len + need >= size) { break; }
+        if(x)
+        {
+            memcpy(buf + len, sep, sep_len);
+            len += sep_len;
+        }
+        memcpy(buf + len, value, value_len);
+        len += value_len;
+    }
+    if(size) { buf[len] = 0; }
+    return len;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file reading.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __reading_H__
+#define __reading_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Most values one reading can hold, a full FC03 read */
+#define READING_MAX_VALUES 125
+/** Longest value format_float() writes */
+#define READING_VALUE_MAX 14
+/** Longest separator reading_format() is given, the SD log's ", " */
+#define READING_SEP_MAX 2
+/** Buffer that fits any formatted reading, separators and terminator included */
+#define READING_TEXT_SIZE (READING_MAX_VALUES * READING_VALUE_MAX + (READING_MAX_VALUES - 1) * READING_SEP_MAX + 1)
+
+/**
+ * @brief One decoded reading
+ * Filled once per message and handed to every sink
+ * 
+ */
+struct READING
+{
+    /** Slave address */
+    uint8_t addr;
+    /** Index into send_que, 0xFF for one time messages */
+    uint8_t msg;
+    /** Number of values */
+    uint16_t count;
+    /** reg_type_t the values were decoded as */
+    uint8_t type;
+    /** value = raw * scale + offset */
+    float scale;
+    float offset;
+    /** Reading number since boot */
+    uint32_t seq;
+    /** Time read, unix epoch */
+    uint32_t epoch;
+    /** Outside its deadband, false only goes to the SD log */
+    bool report;
+    float values[READING_MAX_VALUES];
+    /** Raw integer value or IEEE bits, see REG_TRAITS */
+    int32_t raw[READING_MAX_VALUES];
+};
+
+size_t format_float(char* buf, float value);
+size_t format_int(char* buf, int32_t value);
+size_t reading_format(const READING &reading, const char* sep, bool raw, char* buf, size_t size);
+
+#endif
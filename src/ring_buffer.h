@@ -0,0 +1,83 @@
+/**
+ * @file ring_buffer.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-08-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef __ring_buffer_H__
+#define __ring_buffer_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Fixed capacity byte ring
+ * Head/tail run free and are masked on access,
+ * so a frame can be addressed by its start offset
+ * without ever being copied out
+ *
+ * @tparam SIZE Capacity, must be a power of two
+ */
+template <size_t SIZE>
+class RING_BUFFER
+{
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "RING_BUFFER size must be a power of two");
+
+    public:
+    /**
+     * @brief Push one byte
+     *
+     * @param value
+     * @return false if full, byte dropped and counted
+     */
+    bool push(uint8_t value)
+    {
+        if(size() == SIZE)
+        {
+            overflow++;
+            return false;
+        }
+        buffer[head & MASK] = value;
+        head++;
+        return true;
+    }
+
+    /**
+     * @brief Byte at an absolute offset
+     *
+     * @param offset Offset returned by write_pos()/read_pos()
+     * @return uint8_t
+     */
+    uint8_t at(uint32_t offset) const { return buffer[offset & MASK]; }
+
+    /**
+     * @brief Drop bytes up to an absolute offset
+     *
+     * @param offset
+     */
+    void release(uint32_t offset) { tail = offset; }
+
+    /** Drop everything buffered */
+    void clear() { tail = head; }
+
+    uint32_t write_pos() const { return head; }
+    uint32_t read_pos() const { return tail; }
+    size_t size() const { return head - tail; }
+    size_t capacity() const { return SIZE; }
+
+    /** Bytes dropped because the ring was full */
+    uint32_t overflow = 0;
+
+    private:
+    static const uint32_t MASK = SIZE - 1;
+    uint8_t buffer[SIZE];
+    uint32_t head = 0;
+    uint32_t tail = 0;
+};
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file rs485_msg.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <rs485_msg.h>
+#include <string.h>
+
+/**
+ * @brief Append a message
+ * 
+ * @param frame Frame including CRC
+ * @param len 
+ * @param interval Poll interval in ms, 0 follows delay_time
+ * @param priority Lower goes first
+ */
+void MSG_QUE::add(const uint8_t* frame, uint16_t len, uint32_t interval, uint8_t priority)
+{
+    RS485_MSG msg;
+    msg.offset = arena.size();
+    msg.len = len;
+    msg.interval = interval;
+    msg.priority = priority;
+    msg.decode = DECODE_DEFAULT;
+    msg.deadband = DEADBAND_NONE;
+    arena.insert(arena.end(), frame, frame + len);
+    msgs.push_back(msg);
+}
+
+/**
+ * @brief Remove a message and close the gap in the arena
+ * 
+ * @param index 
+ */
+void MSG_QUE::remove(size_t index)
+{
+    RS485_MSG gone = msgs[index];
+    arena.erase(arena.begin() + gone.offset, arena.begin() + gone.offset + gone.len);
+    msgs.erase(msgs.begin() + index);
+    for(RS485_MSG &msg : msgs)
+    {
+        if(msg.offset > gone.offset) { msg.offset -= gone.len; }
+    }
+}
+
+/**
+ * @brief Find a message by its frame
+ * 
+ * @param frame 
+ * @param len 
+ * @return int16_t index, -1 if not queued
+ */
+int16_t MSG_QUE::find(const uint8_t* frame, uint16_t len) const
+{
+    for(size_t x = 0; x < msgs.size(); x++)
+    {
+        if(msgs[x].len == len && memcmp(&arena[msgs[x].offset], frame, len) == 0) { return x; }
+    }
+    return -1;
+}
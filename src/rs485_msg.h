@@ -0,0 +1,63 @@
+/**
+ * @file rs485_msg.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __rs485_msg_H__
+#define __rs485_msg_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <decode.h>
+#include <deadband.h>
+
+/**
+ * @brief Repeated RS485 message and its schedule
+ * Frame bytes live in the MSG_QUE arena
+ * 
+ */
+struct RS485_MSG
+{
+    /** Frame offset into the arena */
+    uint16_t offset;
+    /** Frame length including CRC */
+    uint16_t len;
+    /** Poll interval in ms, 0 follows delay_time */
+    uint32_t interval;
+    /** Lower goes first when several polls are due */
+    uint8_t priority;
+    /** How the reply registers are decoded */
+    DECODE_DESC decode;
+    /** When a reading is worth publishing */
+    DEADBAND_DESC deadband;
+};
+
+/**
+ * @brief Repeated messages with their frames packed
+ * back to back in one arena, no per message allocation
+ * 
+ */
+class MSG_QUE
+{
+    public:
+    void add(const uint8_t* frame, uint16_t len, uint32_t interval, uint8_t priority);
+    void remove(size_t index);
+    int16_t find(const uint8_t* frame, uint16_t len) const;
+    const uint8_t* frame(size_t index) const { return &arena[msgs[index].offset]; }
+    RS485_MSG& operator[](size_t index) { return msgs[index]; }
+    const RS485_MSG& operator[](size_t index) const { return msgs[index]; }
+    size_t size() const { return msgs.size(); }
+
+    private:
+    std::vector<RS485_MSG> msgs;
+    std::vector<uint8_t> arena;
+};
+
+#endif
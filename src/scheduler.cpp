@@ -0,0 +1,90 @@
+/**
+ * @file scheduler.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <scheduler.h>
+#include <algorithm>
+
+/**
+ * @brief Heap order, earliest due on top
+ * Signed difference keeps working across millis() wrap
+ * 
+ */
+bool later_due(const SCHED_ENTRY &a, const SCHED_ENTRY &b)
+{
+    return (int32_t)(a.due - b.due) > 0;
+}
+
+/**
+ * @brief Heap order, lowest priority value on top, then oldest
+ * 
+ */
+bool less_urgent(const SCHED_ENTRY &a, const SCHED_ENTRY &b)
+{
+    if(a.priority != b.priority) { return a.priority > b.priority; }
+    return later_due(a, b);
+}
+
+/**
+ * @brief Drop every scheduled poll
+ * 
+ */
+void SCHEDULER::clear()
+{
+    timers.clear();
+    ready.clear();
+}
+
+/**
+ * @brief Schedule a poll, first run is immediate
+ * 
+ * @param id Caller's id, returned by next()
+ * @param interval ms between polls
+ * @param priority Lower goes first
+ * @param now millis()
+ */
+void SCHEDULER::add(uint8_t id, uint32_t interval, uint8_t priority, uint32_t now)
+{
+    timers.push_back({now, interval, priority, id});
+    std::push_heap(timers.begin(), timers.end(), later_due);
+}
+
+/**
+ * @brief Next poll to run
+ * The poll is rescheduled one interval on, if it fell
+ * more than an interval behind it skips ahead instead
+ * of bursting to catch up
+ * 
+ * @param now millis()
+ * @return int16_t id, -1 if nothing is due
+ */
+int16_t SCHEDULER::next(uint32_t now)
+{
+    while(!timers.empty() && (int32_t)(now - timers.front().due) >= 0)
+    {
+        std::pop_heap(timers.begin(), timers.end(), later_due);
+        ready.push_back(timers.back());
+        timers.pop_back();
+        std::push_heap(ready.begin(), ready.end(), less_urgent);
+    }
+
+    if(ready.empty()) { return -1; }
+
+    std::pop_heap(ready.begin(), ready.end(), less_urgent);
+    SCHED_ENTRY entry = ready.back();
+    ready.pop_back();
+
+    entry.due += entry.interval;
+    if((int32_t)(now - entry.due) >= 0) { entry.due = now + entry.interval; }
+    timers.push_back(entry);
+    std::push_heap(timers.begin(), timers.end(), later_due);
+
+    return entry.id;
+}
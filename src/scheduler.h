@@ -0,0 +1,51 @@
+/**
+ * @file scheduler.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-08-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __scheduler_H__
+#define __scheduler_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief One scheduled poll
+ * 
+ */
+struct SCHED_ENTRY
+{
+    uint32_t due;
+    uint32_t interval;
+    uint8_t priority;
+    uint8_t id;
+};
+
+/**
+ * @brief Poll scheduler
+ * Timer min-heap keyed on due time feeding a ready
+ * min-heap keyed on priority, so everything that is due
+ * fires back to back, most important first
+ * 
+ */
+class SCHEDULER
+{
+    public:
+    void clear();
+    void add(uint8_t id, uint32_t interval, uint8_t priority, uint32_t now);
+    int16_t next(uint32_t now);
+    size_t ready_count() { return ready.size(); }
+
+    private:
+    std::vector<SCHED_ENTRY> timers;
+    std::vector<SCHED_ENTRY> ready;
+};
+
+#endif
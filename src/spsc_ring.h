@@ -0,0 +1,113 @@
+/**
+ * @file spsc_ring.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-09-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __spsc_ring_H__
+#define __spsc_ring_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * @brief Wait free single producer, single consumer ring
+ * One task only calls claim/commit/push, the other only
+ * front/release/pop. Plain std::atomic, no FreeRTOS calls,
+ * so it runs the same under std::thread on a PC
+ * 
+ * @tparam T Record type, copied whole
+ * @tparam SIZE Records, must be a power of two
+ */
+template <typename T, size_t SIZE>
+class SPSC_RING
+{
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SPSC_RING size must be a power of two");
+
+    public:
+    /**
+     * @brief Producer: slot to fill in place
+     * 
+     * @return T* nullptr if full
+     */
+    T* claim()
+    {
+        uint32_t at = head.load(std::memory_order_relaxed);
+        if(at - tail.load(std::memory_order_acquire) == SIZE) { return nullptr; }
+        return &slots[at & MASK];
+    }
+
+    /** Producer: hand the claimed slot to the consumer */
+    void commit() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief Producer: copy a record in
+     * 
+     * @param value 
+     * @return false if full, record dropped and counted
+     */
+    bool push(const T &value)
+    {
+        T* slot = claim();
+        if(slot == nullptr)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        *slot = value;
+        commit();
+        return true;
+    }
+
+    /**
+     * @brief Consumer: oldest record, read in place
+     * 
+     * @return T* nullptr if empty
+     */
+    T* front()
+    {
+        uint32_t at = tail.load(std::memory_order_relaxed);
+        if(at == head.load(std::memory_order_acquire)) { return nullptr; }
+        return &slots[at & MASK];
+    }
+
+    /** Consumer: give the front slot back to the producer */
+    void release() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief Consumer: copy the oldest record out
+     * 
+     * @param value 
+     * @return false if empty
+     */
+    bool pop(T &value)
+    {
+        T* slot = front();
+        if(slot == nullptr) { return false; }
+        value = *slot;
+        release();
+        return true;
+    }
+
+    /** Records waiting, exact only from either end's own task */
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t capacity() const { return SIZE; }
+
+    /** Records lost to a full ring */
+    std::atomic<uint32_t> dropped{0};
+
+    private:
+    static const uint32_t MASK = SIZE - 1;
+    T slots[SIZE];
+    /** Own cache lines on a PC, harmless on the ESP32 */
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+};
+
+#endif
@@ -0,0 +1,265 @@
+/**
+ * @file stall.cpp
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-17
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <Arduino.h>
+#include <stall.h>
+#include <crc16.h>
+#include <esp_attr.h>
+
+/** Profiler shared by both tasks */
+STALLS stalls;
+/** Survives the watchdog's software reset, checked by magic and CRC */
+RTC_NOINIT_ATTR STALL_DUMP stall_dump;
+/** Watchdog task, highest priority so a busy task can not starve it */
+#define STALL_TASK_STACK 3072
+#define STALL_TASK_PRIORITY 5
+TaskHandle_t stall_handle;
+
+/** Reported after the task name, rs485.step, net.sd.flush */
+static const char* tag_names[STALL_TAGS] = {
+    "none", "config", "rx", "step", "send", "flash", "serial",
+    "connect", "mqtt", "replay", "publish", "report", "sd.write", "sd.flush"
+};
+static const char* task_names[STALL_TASKS] = {"rs485", "net"};
+
+/**
+ * @brief CRC of the dump after the crc field
+ * 
+ */
+static uint16_t dump_crc(const STALL_DUMP &dump)
+{
+    const uint8_t* start = (const uint8_t*)&dump.task;
+    return crc16(start, sizeof(STALL_DUMP) - (start - (const uint8_t*)&dump));
+}
+
+/**
+ * @brief Pick up a dump from before the reset and start the watchdog
+ * 
+ */
+void STALLS::stall_setup()
+{
+    if(stall_dump.magic == STALL_MAGIC && stall_dump.crc == dump_crc(stall_dump))
+    {
+        last = stall_dump;
+        sd_pending = true;
+        mqtt_pending = true;
+    }
+    stall_dump.magic = 0;
+    xTaskCreatePinnedToCore(watchdog, "stall", STALL_TASK_STACK, this, STALL_TASK_PRIORITY, &stall_handle, 0);
+}
+
+/**
+ * @brief Watch the calling task, it has to call beat() every timeout_ms
+ * 
+ * @param task 
+ * @param timeout_ms 
+ */
+void STALLS::stall_register(stall_task_t task, uint32_t timeout_ms)
+{
+    tasks[task].timeout_ms = timeout_ms;
+    tasks[task].beat.store(millis(), std::memory_order_relaxed);
+    tasks[task].handle = xTaskGetCurrentTaskHandle();
+}
+
+/**
+ * @brief Task is alive, once per loop
+ * 
+ * @param task 
+ */
+void STALLS::beat(stall_task_t task)
+{
+    tasks[task].beat.store(millis(), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Probe state of the calling task
+ * 
+ * @return STALL_TASK* nullptr for tasks that are not watched
+ */
+STALL_TASK* STALLS::current()
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for(uint8_t x = 0; x < STALL_TASKS; x++)
+    {
+        if(tasks[x].handle == self) { return &tasks[x]; }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Probe opened
+ * 
+ * @param tag 
+ */
+void STALLS::enter(stall_tag_t tag)
+{
+    STALL_TASK* task = current();
+    if(task == nullptr) { return; }
+    uint8_t depth = task->depth.load(std::memory_order_relaxed);
+    if(depth < STALL_DEPTH)
+    {
+        task->tags[depth] = tag;
+        task->starts[depth] = micros();
+    }
+    task->depth.store(depth + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Probe closed, kept if it is one of the worst so far
+ * 
+ */
+void STALLS::leave()
+{
+    STALL_TASK* task = current();
+    if(task == nullptr) { return; }
+    uint8_t depth = task->depth.load(std::memory_order_relaxed);
+    if(depth == 0) { return; }
+    depth--;
+    task->depth.store(depth, std::memory_order_release);
+    if(depth >= STALL_DEPTH) { return; }
+
+    uint32_t took = micros() - task->starts[depth];
+    if(took < STALL_MIN_US) { return; }
+    uint8_t least = 0;
+    for(uint8_t x = 1; x < STALL_WORST; x++)
+    {
+        if(task->worst[x].us < task->worst[least].us) { least = x; }
+    }
+    if(took <= task->worst[least].us) { return; }
+    task->worst[least] = {took, (uint32_t)millis(), task->tags[depth], (uint8_t)(task - tasks)};
+}
+
+/**
+ * @brief Worst stalls of both tasks, longest first
+ * 
+ * @param out STALL_WORST records
+ * @param reset Forget them once read
+ * @return size_t Records written
+ */
+size_t STALLS::worst(STALL_REC* out, bool reset)
+{
+    size_t len = 0;
+    for(uint8_t x = 0; x < STALL_TASKS; x++)
+    {
+        for(uint8_t y = 0; y < STALL_WORST; y++)
+        {
+            STALL_REC rec = tasks[x].worst[y];
+            if(reset) { tasks[x].worst[y].us = 0; }
+            if(rec.us == 0) { continue; }
+            /** Keep the top STALL_WORST, sorted as they go in */
+            size_t at = len;
+            if(len < STALL_WORST) { len++; }
+            else if(rec.us <= out[STALL_WORST - 1].us) { continue; }
+            else { at = STALL_WORST - 1; }
+            for(; at > 0 && out[at - 1].us < rec.us; at--) { out[at] = out[at - 1]; }
+            out[at] = rec;
+        }
+    }
+    return len;
+}
+
+const char* STALLS::tag_name(uint8_t tag)
+{
+    return tag < STALL_TAGS ? tag_names[tag] : "?";
+}
+
+/**
+ * @brief Stall list as task.tag:us@s, worst first
+ * 
+ */
+static size_t format_list(char* buf, size_t size, const STALL_REC* list, size_t num)
+{
+    size_t len = 0;
+    for(size_t x = 0; x < num && len + 1 < size; x++)
+    {
+        int n = snprintf(buf + len, size - len, "%s%s.%s:%u@%u", x ? ";" : "", task_names[list[x].task < STALL_TASKS ? list[x].task : 0],
+            STALLS::tag_name(list[x].tag), (unsigned)list[x].us, (unsigned)(list[x].at / 1000));
+        if(n < 0) { break; }
+        len += n;
+    }
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @brief Worst stalls since boot or the last reset, "live;" then the list
+ * 
+ */
+size_t STALLS::format_worst(char* buf, size_t size, bool reset)
+{
+    STALL_REC list[STALL_WORST];
+    size_t num = worst(list, reset);
+    int len = snprintf(buf, size, "live;");
+    if(len < 0 || (size_t)len >= size) { return 0; }
+    return len + format_list(buf + len, size - len, list, num);
+}
+
+/**
+ * @brief Dump from before the last reset
+ * "reset;task.tag stuck_ms;uptime_s" then the worst stalls
+ * 
+ */
+size_t STALLS::format_dump(char* buf, size_t size)
+{
+    size_t num = 0;
+    while(num < STALL_WORST && last.worst[num].us > 0) { num++; }
+    int len = snprintf(buf, size, "reset;%s.%s %u;%u;", task_names[last.task < STALL_TASKS ? last.task : 0], tag_name(last.tag),
+        (unsigned)last.stuck_ms, (unsigned)(last.uptime_ms / 1000));
+    if(len < 0 || (size_t)len >= size) { return 0; }
+    return len + format_list(buf + len, size - len, last.worst, num);
+}
+
+/**
+ * @brief Reset the board if a task stopped checking in
+ * The innermost probe it is in says where it is stuck
+ * 
+ */
+void STALLS::check()
+{
+    uint32_t now = millis();
+    for(uint8_t x = 0; x < STALL_TASKS; x++)
+    {
+        STALL_TASK &task = tasks[x];
+        if(task.handle == nullptr || task.timeout_ms == 0) { continue; }
+        uint32_t stuck = now - task.beat.load(std::memory_order_relaxed);
+        if(stuck < task.timeout_ms) { continue; }
+
+        uint8_t depth = task.depth.load(std::memory_order_acquire);
+        stall_dump.task = x;
+        stall_dump.tag = depth == 0 ? (uint8_t)STALL_NONE : task.tags[(depth < STALL_DEPTH ? depth : STALL_DEPTH) - 1];
+        stall_dump.stuck_ms = stuck;
+        stall_dump.uptime_ms = now;
+        memset(stall_dump.worst, 0, sizeof(stall_dump.worst));
+        worst(stall_dump.worst, false);
+        stall_dump.crc = dump_crc(stall_dump);
+        stall_dump.magic = STALL_MAGIC;
+
+        Serial.print("[STALL] Watchdog reset, ");
+        Serial.print(task_names[x]);
+        Serial.print(" stuck in ");
+        Serial.println(tag_name(stall_dump.tag));
+        ESP.restart();
+    }
+}
+
+/**
+ * @brief Watchdog task
+ * 
+ * @param param STALLS
+ */
+void STALLS::watchdog(void* param)
+{
+    STALLS* self = (STALLS*)param;
+    for(;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(STALL_CHECK_TIME));
+        self->check();
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * @file stall.h
+ * @author Jamie Howse (r4wknet@gmail.com)
+ * @brief 
+ * @version 0.1
+ * @date 2023-10-17
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef __stall_H__
+#define __stall_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/** Worst stalls kept per task */
+#define STALL_WORST 8
+/** Shorter steps are not stalls, us */
+#define STALL_MIN_US 1000
+/** Probes open at once per task */
+#define STALL_DEPTH 4
+/** Watchdog poll period, ms */
+#define STALL_CHECK_TIME 1000
+/** A watchdog dump survived the reset */
+#define STALL_MAGIC 0x4C415453
+
+/** Tasks the watchdog watches */
+enum stall_task_t
+{
+    STALL_TASK_RS485,
+    STALL_TASK_NET,
+    STALL_TASKS
+};
+
+/** Subsystem step a probe times */
+enum stall_tag_t
+{
+    STALL_NONE,
+    STALL_CONFIG,
+    STALL_RS485_RX,
+    STALL_RS485_STEP,
+    STALL_RS485_SEND,
+    STALL_FLASH,
+    STALL_SERIAL,
+    STALL_NET_CONNECT,
+    STALL_MQTT_LOOP,
+    STALL_MQTT_REPLAY,
+    STALL_MQTT_PUBLISH,
+    STALL_MQTT_REPORT,
+    STALL_SD_WRITE,
+    STALL_SD_FLUSH,
+    STALL_TAGS
+};
+
+/**
+ * @brief One stall
+ * 
+ */
+struct STALL_REC
+{
+    uint32_t us;
+    /** millis() when it ended */
+    uint32_t at;
+    uint8_t tag;
+    uint8_t task;
+};
+
+/**
+ * @brief What the watchdog saw before it reset the board
+ * Kept in RTC memory that a software reset leaves alone
+ * 
+ */
+struct STALL_DUMP
+{
+    uint32_t magic;
+    uint16_t crc;
+    /** Task that stopped checking in and the innermost probe it was in */
+    uint8_t task;
+    uint8_t tag;
+    /** Time since it last checked in, ms */
+    uint32_t stuck_ms;
+    uint32_t uptime_ms;
+    STALL_REC worst[STALL_WORST];
+};
+
+/**
+ * @brief Per task probe state, written only by that task
+ * 
+ */
+struct STALL_TASK
+{
+    TaskHandle_t handle;
+    uint32_t timeout_ms;
+    std::atomic<uint32_t> beat;
+    std::atomic<uint8_t> depth;
+    uint8_t tags[STALL_DEPTH];
+    uint32_t starts[STALL_DEPTH];
+    STALL_REC worst[STALL_WORST];
+};
+
+/**
+ * @brief Loop stall profiler and task watchdog
+ * Probes time each subsystem step and keep the worst per task,
+ * a watchdog task resets the board when a task stops checking in,
+ * saving which probe it was stuck in and the worst stalls first
+ * 
+ */
+class STALLS
+{
+    public:
+    void stall_setup();
+    void stall_register(stall_task_t task, uint32_t timeout_ms);
+    void beat(stall_task_t task);
+    void enter(stall_tag_t tag);
+    void leave();
+    size_t worst(STALL_REC* out, bool reset);
+    size_t format_worst(char* buf, size_t size, bool reset);
+    size_t format_dump(char* buf, size_t size);
+    static const char* tag_name(uint8_t tag);
+
+    /** Dump from before the last reset still to be written out */
+    bool sd_pending = false;
+    bool mqtt_pending = false;
+
+    private:
+    static void watchdog(void* param);
+    void check();
+    STALL_TASK* current();
+
+    STALL_TASK tasks[STALL_TASKS] = {};
+    /** Copy of the dump, the RTC one is cleared on boot */
+    STALL_DUMP last = {};
+};
+
+extern STALLS stalls;
+
+/**
+ * @brief Times the enclosing scope
+ * 
+ */
+class STALL_PROBE
+{
+    public:
+    explicit STALL_PROBE(stall_tag_t tag) { stalls.enter(tag); }
+    ~STALL_PROBE() { stalls.leave(); }
+};
+
+#endif